@@ -37,6 +37,79 @@ __device__ bool HitSphere(const cRay& r, const cSphere& s, float tMin, float tMa
     return false;
 }
 
+// one loop per primitive type, the same tests as Primitives.cpp
+__device__ void HitPlanes(const cPlanes& p, const cRay& r, float tMin, float& closest, int& hitId, int& hitType)
+{
+    for (int i = 0; i < p.count; ++i)
+    {
+        float3 n = make_float3(p.nx[i], p.ny[i], p.nz[i]);
+        float t = (p.d[i] - dot(n, r.orig)) / dot(n, r.dir);
+        if (t > tMin && t < closest)
+        {
+            closest = t;
+            hitId = i;
+            hitType = kPrimPlane;
+        }
+    }
+}
+
+__device__ void HitBoxes(const cBoxes& b, const cRay& r, float tMin, float& closest, int& hitId, int& hitType)
+{
+    float3 invDir = make_float3(1.0f / r.dir.x, 1.0f / r.dir.y, 1.0f / r.dir.z);
+    for (int i = 0; i < b.count; ++i)
+    {
+        float3 t0 = (make_float3(b.minX[i], b.minY[i], b.minZ[i]) - r.orig) * invDir;
+        float3 t1 = (make_float3(b.maxX[i], b.maxY[i], b.maxZ[i]) - r.orig) * invDir;
+        float3 tSmall = fminf(t0, t1), tLarge = fmaxf(t0, t1);
+        float tNear = fmaxf(fmaxf(tSmall.x, tSmall.y), tSmall.z);
+        float tFar = fminf(fminf(tLarge.x, tLarge.y), tLarge.z);
+        float t = tNear > tMin ? tNear : tFar;
+        if (tNear <= tFar && t > tMin && t < closest)
+        {
+            closest = t;
+            hitId = i;
+            hitType = kPrimBox;
+        }
+    }
+}
+
+__device__ void HitDisks(const cDisks& d, const cRay& r, float tMin, float& closest, int& hitId, int& hitType)
+{
+    for (int i = 0; i < d.count; ++i)
+    {
+        float3 oc = make_float3(d.cx[i], d.cy[i], d.cz[i]) - r.orig;
+        float3 n = make_float3(d.nx[i], d.ny[i], d.nz[i]);
+        float t = dot(n, oc) / dot(n, r.dir);
+        float3 p = r.dir * t - oc;
+        if (t > tMin && t < closest && dot(p, p) <= d.radius2[i])
+        {
+            closest = t;
+            hitId = i;
+            hitType = kPrimDisk;
+        }
+    }
+}
+
+__device__ void HitQuads(const cQuads& q, const cRay& r, float tMin, float& closest, int& hitId, int& hitType)
+{
+    for (int i = 0; i < q.count; ++i)
+    {
+        float3 oc = make_float3(q.ox[i], q.oy[i], q.oz[i]) - r.orig;
+        float3 n = make_float3(q.nx[i], q.ny[i], q.nz[i]);
+        float t = dot(n, oc) / dot(n, r.dir);
+        float3 p = r.dir * t - oc;
+        float3 w = make_float3(q.wx[i], q.wy[i], q.wz[i]);
+        float a = dot(w, cross(p, make_float3(q.vx[i], q.vy[i], q.vz[i])));
+        float b = dot(w, cross(make_float3(q.ux[i], q.uy[i], q.uz[i]), p));
+        if (t > tMin && t < closest && a >= 0 && a <= 1 && b >= 0 && b <= 1)
+        {
+            closest = t;
+            hitId = i;
+            hitType = kPrimQuad;
+        }
+    }
+}
+
 __global__ void HitWorldKernel(const DeviceData data, const int numRays, const float tMin, const float tMax)
 {
     const int rIdx = blockIdx.x*blockDim.x + threadIdx.x;
@@ -45,7 +118,7 @@ __global__ void HitWorldKernel(const DeviceData data, const int numRays, const f
 
     const cRay& r = data.rays[rIdx];
 
-    int hitId = -1;
+    int hitId = -1, hitType = kPrimSphere;
     float closest = tMax, hitT;
     for (int i = 0; i < data.spheresCount; ++i)
     {
@@ -55,11 +128,26 @@ __global__ void HitWorldKernel(const DeviceData data, const int numRays, const f
             hitId = i;
         }
     }
+    HitPlanes(data.planes, r, tMin, closest, hitId, hitType);
+    HitBoxes(data.boxes, r, tMin, closest, hitId, hitType);
+    HitDisks(data.disks, r, tMin, closest, hitId, hitType);
+    HitQuads(data.quads, r, tMin, closest, hitId, hitType);
 
-    data.hits[rIdx] = cHit(closest, hitId);
+    data.hits[rIdx] = cHit(closest, hitId, hitType);
+}
+
+// device copy of one pool array
+static float* UploadArray(const std::vector<float>& v)
+{
+    float* dev = NULL;
+    if (v.empty())
+        return dev;
+    cudaMalloc((void**)&dev, v.size() * sizeof(float));
+    cudaMemcpy(dev, v.data(), v.size() * sizeof(float), cudaMemcpyHostToDevice);
+    return dev;
 }
 
-void initDeviceData(const Sphere* spheres, const int spheresCount, const int numRays, DeviceData& data)
+void initDeviceData(const Sphere* spheres, const int spheresCount, const PrimitivePools& prims, const int numRays, DeviceData& data)
 {
     data.numRays = numRays;
     data.spheresCount = spheresCount;
@@ -71,27 +159,68 @@ void initDeviceData(const Sphere* spheres, const int spheresCount, const int num
 
     // copy spheres to device
     cudaMemcpy(data.spheres, spheres, spheresCount * sizeof(cSphere), cudaMemcpyHostToDevice);
+
+    // and the primitive pools, array by array
+    const PlanePool& pl = prims.planes;
+    data.planes = { UploadArray(pl.nx), UploadArray(pl.ny), UploadArray(pl.nz), UploadArray(pl.d), int(pl.d.size()) };
+    const BoxPool& bx = prims.boxes;
+    data.boxes = { UploadArray(bx.minX), UploadArray(bx.minY), UploadArray(bx.minZ), UploadArray(bx.maxX), UploadArray(bx.maxY), UploadArray(bx.maxZ), int(bx.minX.size()) };
+    const DiskPool& dk = prims.disks;
+    data.disks = { UploadArray(dk.cx), UploadArray(dk.cy), UploadArray(dk.cz), UploadArray(dk.nx), UploadArray(dk.ny), UploadArray(dk.nz), UploadArray(dk.radius2), int(dk.radius2.size()) };
+    const QuadPool& q = prims.quads;
+    data.quads = { UploadArray(q.ox), UploadArray(q.oy), UploadArray(q.oz), UploadArray(q.ux), UploadArray(q.uy), UploadArray(q.uz),
+        UploadArray(q.vx), UploadArray(q.vy), UploadArray(q.vz), UploadArray(q.nx), UploadArray(q.ny), UploadArray(q.nz),
+        UploadArray(q.wx), UploadArray(q.wy), UploadArray(q.wz), int(q.ox.size()) };
 }
 
-void HitWorldDevice(const Ray* rays, const int numRays, float tMin, float tMax, Hit* hits, DeviceData data)
+void updateDeviceSpheres(const Sphere* spheres, const int* dirty, const int numDirty, const DeviceData& data)
+{
+    for (int i = 0; i < numDirty; i++)
+        cudaMemcpy(data.spheres + dirty[i], spheres + dirty[i], sizeof(cSphere), cudaMemcpyHostToDevice);
+}
+
+void uploadRaysDevice(const Ray* rays, const int numRays, const DeviceData& data)
 {
-    // copy rays to device
     cudaMemcpy(data.rays, rays, numRays * sizeof(cRay), cudaMemcpyHostToDevice);
+}
 
-    // call kernel
+void launchHitWorldKernel(const int numRays, float tMin, float tMax, const DeviceData& data)
+{
     const int threadsPerBlock = 1024;
-    const int blocksPerGrid = ceilf((float)data.numRays / threadsPerBlock);
+    const int blocksPerGrid = ceilf((float)numRays / threadsPerBlock);
 
     HitWorldKernel <<<blocksPerGrid, threadsPerBlock >>> (data, numRays, tMin, tMax);
+}
 
-    // copy hits to host
+void downloadHitsDevice(Hit* hits, const int numRays, const DeviceData& data)
+{
     cudaMemcpy(hits, data.hits, numRays * sizeof(cHit), cudaMemcpyDeviceToHost);
 }
 
+void HitWorldDevice(const Ray* rays, const int numRays, float tMin, float tMax, Hit* hits, DeviceData data)
+{
+    // copy rays to device
+    uploadRaysDevice(rays, numRays, data);
+
+    // call kernel
+    launchHitWorldKernel(numRays, tMin, tMax, data);
+
+    // copy hits to host
+    downloadHitsDevice(hits, numRays, data);
+}
+
 
 void freeDeviceData(const DeviceData& data)
 {
     cudaFree(data.spheres);
     cudaFree(data.rays);
     cudaFree(data.hits);
+    float* pools[] = {
+        data.planes.nx, data.planes.ny, data.planes.nz, data.planes.d,
+        data.boxes.minX, data.boxes.minY, data.boxes.minZ, data.boxes.maxX, data.boxes.maxY, data.boxes.maxZ,
+        data.disks.cx, data.disks.cy, data.disks.cz, data.disks.nx, data.disks.ny, data.disks.nz, data.disks.radius2,
+        data.quads.ox, data.quads.oy, data.quads.oz, data.quads.ux, data.quads.uy, data.quads.uz, data.quads.vx, data.quads.vy, data.quads.vz,
+        data.quads.nx, data.quads.ny, data.quads.nz, data.quads.wx, data.quads.wy, data.quads.wz };
+    for (float* pool : pools)
+        cudaFree(pool);
 }
@@ -4,15 +4,17 @@
 #include <assert.h>
 
 #include "../Source/Maths.h"
+#include "../Source/Primitives.h"
 #include "device_launch_parameters.h"
 
 struct cHit
 {
     __device__ cHit() {}
-    __device__ cHit(float _t, float _id) :t(_t), id(_id) {}
+    __device__ cHit(float _t, int _id, int _type) :t(_t), id(_id), type(_type) {}
 
     float t;
     int id;
+    int type;
 };
 
 struct cRay
@@ -30,17 +32,35 @@ struct cSphere
     float _not_used;
 };
 
+// device copies of the PrimitivePools arrays, same layout
+struct cPlanes { float *nx, *ny, *nz, *d; int count; };
+struct cBoxes { float *minX, *minY, *minZ, *maxX, *maxY, *maxZ; int count; };
+struct cDisks { float *cx, *cy, *cz, *nx, *ny, *nz, *radius2; int count; };
+struct cQuads { float *ox, *oy, *oz, *ux, *uy, *uz, *vx, *vy, *vz, *nx, *ny, *nz, *wx, *wy, *wz; int count; };
+
 struct DeviceData
 {
     cRay* rays;
     cHit* hits;
     cSphere* spheres;
+    cPlanes planes;
+    cBoxes boxes;
+    cDisks disks;
+    cQuads quads;
     int numRays;
     int spheresCount;
 };
 
-void initDeviceData(const Sphere* spheres, const int spheresCount, const int numRays, DeviceData& data);
+void initDeviceData(const Sphere* spheres, const int spheresCount, const PrimitivePools& prims, const int numRays, DeviceData& data);
+
+// copies spheres[dirty[i]] to the device, leaving the others alone
+void updateDeviceSpheres(const Sphere* spheres, const int* dirty, const int numDirty, const DeviceData& data);
 
 void HitWorldDevice(const Ray* rays, const int numRays, float tMin, float tMax, Hit* hits, DeviceData data);
 
+// individual steps of HitWorldDevice, used by the pluggable intersection backend
+void uploadRaysDevice(const Ray* rays, const int numRays, const DeviceData& data);
+void launchHitWorldKernel(const int numRays, float tMin, float tMax, const DeviceData& data);
+void downloadHitsDevice(Hit* hits, const int numRays, const DeviceData& data);
+
 void freeDeviceData(const DeviceData& data);
@@ -0,0 +1,44 @@
+#include "Animation.h"
+
+static void EvaluateTrack(const SphereTrack& track, float time, f3& outCenter, float& outRadius)
+{
+    const SphereKey* keys = track.keys;
+    if (time <= keys[0].time || track.numKeys == 1)
+    {
+        outCenter = keys[0].center;
+        outRadius = keys[0].radius;
+        return;
+    }
+    for (int k = 1; k < track.numKeys; k++)
+    {
+        if (time < keys[k].time)
+        {
+            float t = (time - keys[k - 1].time) / (keys[k].time - keys[k - 1].time);
+            outCenter = keys[k - 1].center * (1 - t) + keys[k].center * t;
+            outRadius = keys[k - 1].radius * (1 - t) + keys[k].radius * t;
+            return;
+        }
+    }
+    outCenter = keys[track.numKeys - 1].center;
+    outRadius = keys[track.numKeys - 1].radius;
+}
+
+int AnimateSpheres(const SphereTrack* tracks, int numTracks, float time, Sphere* spheres, int* outDirty)
+{
+    int numDirty = 0;
+    for (int i = 0; i < numTracks; i++)
+    {
+        f3 center;
+        float radius;
+        EvaluateTrack(tracks[i], time, center, radius);
+
+        Sphere& s = spheres[tracks[i].sphere];
+        if (center.x == s.center.x && center.y == s.center.y && center.z == s.center.z && radius == s.radius)
+            continue;
+        s.center = center;
+        s.radius = radius;
+        s.UpdateDerivedData();
+        outDirty[numDirty++] = tracks[i].sphere;
+    }
+    return numDirty;
+}
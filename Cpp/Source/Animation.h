@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Maths.h"
+
+struct SphereKey
+{
+    float time;
+    f3 center;
+    float radius;
+};
+
+// keyframes of one sphere, sorted by time
+struct SphereTrack
+{
+    int sphere;
+    const SphereKey* keys;
+    int numKeys;
+};
+
+// Evaluates every track at the given time (linear between keys, clamped outside
+// of them) and writes the result into spheres. Only spheres whose centre or
+// radius actually changed are written; their indices are returned in outDirty.
+int AnimateSpheres(const SphereTrack* tracks, int numTracks, float time, Sphere* spheres, int* outDirty);
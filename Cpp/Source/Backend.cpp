@@ -0,0 +1,295 @@
+#include "Backend.h"
+#include "Bvh.h"
+#include "Parallel.h"
+#include "Timer.h"
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+
+#if DO_CUDA_RENDER
+#include "../Cuda/CudaRender.cuh"
+#endif // DO_CUDA_RENDER
+
+static void HitWorldRay(const Sphere* spheres, int spheresCount, const PrimitivePools& prims, const WaveRay& ray, float tMin, float tMax, WaveHit& hit)
+{
+    const Ray r = LoadRay(ray);
+
+    float closest = tMax, hitT;
+    Hit h(tMax, -1);
+    for (int i = 0; i < spheresCount; ++i)
+    {
+        if (HitSphere(r, spheres[i], tMin, closest, hitT))
+        {
+            closest = hitT;
+            h = Hit(hitT, i);
+        }
+    }
+    HitPrimitives(prims, r, tMin, closest, h);
+
+    StoreHit(hit, h);
+}
+
+void HitWorld(const Sphere* spheres, int spheresCount, const PrimitivePools& prims, const WaveRay* rays, int numRays, float tMin, float tMax, WaveHit* hits)
+{
+    for (int rIdx = 0; rIdx < numRays; rIdx++)
+        HitWorldRay(spheres, spheresCount, prims, rays[rIdx], tMin, tMax, hits[rIdx]);
+}
+
+static void HitWorldBvh(const Sphere* spheres, const Bvh& bvh, const PrimitivePools& prims, const WaveRay* rays, int numRays, float tMin, float tMax, WaveHit* hits)
+{
+    for (int rIdx = 0; rIdx < numRays; rIdx++)
+    {
+        const Ray r = LoadRay(rays[rIdx]);
+
+        // the unbounded planes are tested first, which often shrinks closest enough
+        // to cull much of the BVH
+        float closest = tMax;
+        Hit h(tMax, -1);
+        HitPrimitives(prims, r, tMin, closest, h);
+        TraverseBvh(bvh, r, tMin, closest, [&](int i, float& closestT)
+        {
+            float hitT;
+            if (HitSphere(r, spheres[i], tMin, closestT, hitT))
+            {
+                closestT = hitT;
+                h = Hit(hitT, i);
+            }
+        });
+
+        StoreHit(hits[rIdx], h);
+    }
+}
+
+void IntersectBackend::Trace(const WaveRay* rays, int numRays, float tMin, float tMax, WaveHit* hits)
+{
+    for (int start = 0; start < numRays; start += m_MaxBatch)
+    {
+        int count = std::min(m_MaxBatch, numRays - start);
+        UploadRays(rays + start, count);
+        Intersect(count, tMin, tMax);
+        DownloadHits(hits + start, count);
+    }
+}
+
+
+// Host intersection straight out of the wavefront arrays, through a BVH over the
+// spheres once there are enough of them for it to beat the plain loop. Trace
+// skips the staging buffers, the individual steps exist so it honours the
+// interface; their hit buffer is only allocated once something uses them.
+class CpuBackend : public IntersectBackend
+{
+public:
+    const char* Name() const override { return "cpu"; }
+
+    void InitScene(const Sphere* spheres, int spheresCount, const PrimitivePools& prims, int maxBatch) override
+    {
+        m_Spheres = spheres;
+        m_SpheresCount = spheresCount;
+        m_Prims = prims;
+        m_MaxBatch = maxBatch;
+
+        m_Boxes.resize(spheresCount);
+        for (int i = 0; i < spheresCount; i++)
+            m_Boxes[i] = SphereBounds(spheres[i]);
+        m_Bvh.Build(m_Boxes.data(), spheresCount);
+    }
+
+    // the spheres are shared with the renderer, so only the BVH needs updating:
+    // refit it, and rebuild once the refit tree got too much worse than a fresh one
+    void UpdateSpheres(const Sphere* spheres, const int* dirty, int numDirty) override
+    {
+        for (int i = 0; i < numDirty; i++)
+            m_Boxes[dirty[i]] = SphereBounds(spheres[dirty[i]]);
+        m_Bvh.Refit(m_Boxes.data());
+        m_Refits++;
+        if (m_Bvh.SahCost() > m_Bvh.builtCost * kRebuildRatio)
+        {
+            m_Bvh.Build(m_Boxes.data(), m_SpheresCount);
+            m_Rebuilds++;
+        }
+    }
+
+    void UploadRays(const WaveRay* rays, int numRays) override { m_Rays = rays; }
+    void Intersect(int numRays, float tMin, float tMax) override
+    {
+        if (m_Hits == NULL)
+            m_Hits = new WaveHit[m_MaxBatch];
+        Trace(m_Rays, numRays, tMin, tMax, m_Hits);
+    }
+    void DownloadHits(WaveHit* hits, int numRays) override { memcpy(hits, m_Hits, numRays * sizeof(WaveHit)); }
+    void Free() override { delete[] m_Hits; m_Hits = NULL; }
+
+    void Trace(const WaveRay* rays, int numRays, float tMin, float tMax, WaveHit* hits) override
+    {
+        ParallelFor(numRays, kTraceChunk, [&](int chunk, int begin, int end)
+        {
+            if (m_SpheresCount >= kBvhMinSpheres)
+                HitWorldBvh(m_Spheres, m_Bvh, m_Prims, rays + begin, end - begin, tMin, tMax, hits + begin);
+            else
+                HitWorld(m_Spheres, m_SpheresCount, m_Prims, rays + begin, end - begin, tMin, tMax, hits + begin);
+        });
+    }
+
+    void PrintStats() const override
+    {
+        if (m_Refits > 0)
+            printf("%s: %d BVH refits, %d rebuilds, SAH cost %.2f (%.2f when built)\n", Name(), m_Refits, m_Rebuilds, m_Bvh.SahCost(), m_Bvh.builtCost);
+    }
+
+private:
+    static const int kTraceChunk = 4096;
+    // below this the box tests cost more than testing every sphere (3x slower at 9)
+    static const int kBvhMinSpheres = 16;
+    static constexpr float kRebuildRatio = kRefitRebuildRatio;
+
+    Bvh m_Bvh;
+    std::vector<Aabb> m_Boxes;
+    int m_Refits = 0, m_Rebuilds = 0;
+    const Sphere* m_Spheres = NULL;
+    int m_SpheresCount = 0;
+    PrimitivePools m_Prims;
+    const WaveRay* m_Rays = NULL;
+    WaveHit* m_Hits = NULL;
+};
+
+
+// Runs the device path on the host: separate "device" allocations for spheres,
+// rays and hits, explicit copies in both directions, and a kernel emulated as a
+// grid of fixed size blocks. Copy volume and time per step are recorded so batch
+// sizes and transfer overhead can be studied without a GPU.
+class EmulatedDeviceBackend : public IntersectBackend
+{
+public:
+    const char* Name() const override { return "emulated-device"; }
+
+    void InitScene(const Sphere* spheres, int spheresCount, const PrimitivePools& prims, int maxBatch) override
+    {
+        m_MaxBatch = maxBatch;
+        m_SpheresCount = spheresCount;
+
+        // allocate device memory
+        m_DevSpheres = new Sphere[spheresCount];
+        m_DevRays = new WaveRay[maxBatch];
+        m_DevHits = new WaveHit[maxBatch];
+
+        // copy spheres and primitive pools to device
+        memcpy(m_DevSpheres, spheres, spheresCount * sizeof(Sphere));
+        m_BytesUp += spheresCount * sizeof(Sphere);
+        m_DevPrims = prims;
+        m_BytesUp += PoolBytes(prims);
+    }
+
+    void UpdateSpheres(const Sphere* spheres, const int* dirty, int numDirty) override
+    {
+        for (int i = 0; i < numDirty; i++)
+            m_DevSpheres[dirty[i]] = spheres[dirty[i]];
+        m_BytesUp += numDirty * sizeof(Sphere);
+        m_SphereUpdates += numDirty;
+    }
+
+    void UploadRays(const WaveRay* rays, int numRays) override
+    {
+        assert(numRays <= m_MaxBatch);
+        double t0 = NowSeconds();
+        memcpy(m_DevRays, rays, numRays * sizeof(WaveRay));
+        m_UploadTime += NowSeconds() - t0;
+        m_BytesUp += numRays * sizeof(WaveRay);
+        m_Batches++;
+    }
+
+    void Intersect(int numRays, float tMin, float tMax) override
+    {
+        double t0 = NowSeconds();
+        // blocks run concurrently on the thread pool, like blocks on the multiprocessors
+        ParallelFor(numRays, kThreadsPerBlock, [&](int blockIdx, int begin, int end)
+        {
+            for (int rIdx = begin; rIdx < end; rIdx++)
+                HitWorldRay(m_DevSpheres, m_SpheresCount, m_DevPrims, m_DevRays[rIdx], tMin, tMax, m_DevHits[rIdx]);
+        });
+        m_KernelTime += NowSeconds() - t0;
+    }
+
+    void DownloadHits(WaveHit* hits, int numRays) override
+    {
+        double t0 = NowSeconds();
+        memcpy(hits, m_DevHits, numRays * sizeof(WaveHit));
+        m_DownloadTime += NowSeconds() - t0;
+        m_BytesDown += numRays * sizeof(WaveHit);
+    }
+
+    void Free() override
+    {
+        delete[] m_DevSpheres;
+        delete[] m_DevRays;
+        delete[] m_DevHits;
+        m_DevSpheres = NULL;
+        m_DevRays = NULL;
+        m_DevHits = NULL;
+    }
+
+    void PrintStats() const override
+    {
+        double up = m_BytesUp * 1.0e-6, down = m_BytesDown * 1.0e-6;
+        printf("%s: %d batches of up to %d rays, %d sphere updates\n", Name(), m_Batches, m_MaxBatch, m_SphereUpdates);
+        printf("  upload   %9.1fMB %7.3fs (%.3fs at %.0fGB/s PCIe)\n", up, m_UploadTime, up * 1.0e-3 / kPcieGBps, kPcieGBps);
+        printf("  kernel             %7.3fs\n", m_KernelTime);
+        printf("  download %9.1fMB %7.3fs (%.3fs at %.0fGB/s PCIe)\n", down, m_DownloadTime, down * 1.0e-3 / kPcieGBps, kPcieGBps);
+    }
+
+private:
+    static size_t PoolBytes(const PrimitivePools& p)
+    {
+        return (p.planes.d.size() * 4 + p.boxes.minX.size() * 6 + p.disks.radius2.size() * 7 + p.quads.ox.size() * 15) * sizeof(float);
+    }
+
+    static const int kThreadsPerBlock = 1024;
+    static constexpr double kPcieGBps = 12.0; // effective PCIe 3.0 x16 bandwidth, for the projected copy times
+
+    Sphere* m_DevSpheres = NULL;
+    PrimitivePools m_DevPrims;
+    WaveRay* m_DevRays = NULL;
+    WaveHit* m_DevHits = NULL;
+    int m_SpheresCount = 0;
+
+    int m_Batches = 0;
+    int m_SphereUpdates = 0;
+    double m_BytesUp = 0, m_BytesDown = 0;
+    double m_UploadTime = 0, m_KernelTime = 0, m_DownloadTime = 0;
+};
+
+
+#if DO_CUDA_RENDER
+class CudaBackend : public IntersectBackend
+{
+public:
+    const char* Name() const override { return "cuda"; }
+
+    void InitScene(const Sphere* spheres, int spheresCount, const PrimitivePools& prims, int maxBatch) override
+    {
+        m_MaxBatch = maxBatch;
+        initDeviceData(spheres, spheresCount, prims, maxBatch, m_Data);
+    }
+    void UpdateSpheres(const Sphere* spheres, const int* dirty, int numDirty) override { updateDeviceSpheres(spheres, dirty, numDirty, m_Data); }
+    void UploadRays(const WaveRay* rays, int numRays) override { uploadRaysDevice(rays, numRays, m_Data); }
+    void Intersect(int numRays, float tMin, float tMax) override { launchHitWorldKernel(numRays, tMin, tMax, m_Data); }
+    void DownloadHits(WaveHit* hits, int numRays) override { downloadHitsDevice(hits, numRays, m_Data); }
+    void Free() override { freeDeviceData(m_Data); }
+
+private:
+    DeviceData m_Data;
+};
+#endif // DO_CUDA_RENDER
+
+
+IntersectBackend* CreateIntersectBackend(BackendType type)
+{
+    switch (type)
+    {
+    case kBackendCpu: return new CpuBackend();
+    case kBackendEmulatedDevice: return new EmulatedDeviceBackend();
+#if DO_CUDA_RENDER
+    case kBackendCuda: return new CudaBackend();
+#endif // DO_CUDA_RENDER
+    default: return NULL;
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Test.h"
+#include "Compact.h"
+#include "Primitives.h"
+
+// Runtime intersection backend. Mirrors the device memory model: the scene and a
+// ray batch are uploaded, intersected, and the hits downloaded back to the host.
+class IntersectBackend
+{
+public:
+    virtual ~IntersectBackend() {}
+
+    virtual const char* Name() const = 0;
+    // maxBatch is the largest number of rays a single UploadRays may pass; the
+    // spheres stay shared with the caller, the primitive pools are copied
+    virtual void InitScene(const Sphere* spheres, int spheresCount, const PrimitivePools& prims, int maxBatch) = 0;
+    // spheres[dirty[i]] moved or changed size, upload just those
+    virtual void UpdateSpheres(const Sphere* spheres, const int* dirty, int numDirty) = 0;
+    virtual void UploadRays(const WaveRay* rays, int numRays) = 0;
+    virtual void Intersect(int numRays, float tMin, float tMax) = 0;
+    virtual void DownloadHits(WaveHit* hits, int numRays) = 0;
+    virtual void Free() = 0;
+
+    // upload/intersect/download the whole ray stream in batches of maxBatch
+    virtual void Trace(const WaveRay* rays, int numRays, float tMin, float tMax, WaveHit* hits);
+    virtual void PrintStats() const {}
+
+protected:
+    int m_MaxBatch = 0;
+};
+
+// returns NULL when the backend isn't available in this build
+IntersectBackend* CreateIntersectBackend(BackendType type);
+
+void HitWorld(const Sphere* spheres, int spheresCount, const PrimitivePools& prims, const WaveRay* rays, int numRays, float tMin, float tMax, WaveHit* hits);
@@ -0,0 +1,133 @@
+#include "Bvh.h"
+
+const int kSahBins = 8;
+const int kMaxLeafSize = 2;
+const float kTraversalCost = 1.0f;
+const float kIntersectCost = 1.0f;
+
+static float Axis(const f3& v, int axis) { return axis == 0 ? v.x : (axis == 1 ? v.y : v.z); }
+
+static int BuildNode(Bvh& bvh, const Aabb* boxes, int nodeIdx, int first, int count)
+{
+    Aabb bounds, centroids;
+    for (int i = first; i < first + count; i++)
+    {
+        const Aabb& b = boxes[bvh.primIndices[i]];
+        bounds.Grow(b);
+        f3 c = b.Center();
+        centroids.Grow(Aabb(c, c));
+    }
+    bvh.nodes[nodeIdx].bounds = bounds;
+
+    // find the cheapest binned split along any axis
+    float bestCost = kIntersectCost * count;
+    int bestAxis = -1, bestBin = 0;
+    if (count > kMaxLeafSize)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float lo = Axis(centroids.bmin, axis), hi = Axis(centroids.bmax, axis);
+            if (hi <= lo)
+                continue;
+            Aabb binBounds[kSahBins];
+            int binCount[kSahBins] = {};
+            float scale = kSahBins / (hi - lo);
+            for (int i = first; i < first + count; i++)
+            {
+                const Aabb& b = boxes[bvh.primIndices[i]];
+                int bin = std::min(kSahBins - 1, int((Axis(b.Center(), axis) - lo) * scale));
+                binBounds[bin].Grow(b);
+                binCount[bin]++;
+            }
+            for (int split = 1; split < kSahBins; split++)
+            {
+                Aabb left, right;
+                int nLeft = 0, nRight = 0;
+                for (int b = 0; b < split; b++) { left.Grow(binBounds[b]); nLeft += binCount[b]; }
+                for (int b = split; b < kSahBins; b++) { right.Grow(binBounds[b]); nRight += binCount[b]; }
+                if (nLeft == 0 || nRight == 0)
+                    continue;
+                float cost = kTraversalCost + kIntersectCost * (left.HalfArea() * nLeft + right.HalfArea() * nRight) / bounds.HalfArea();
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = split;
+                }
+            }
+        }
+    }
+
+    if (bestAxis < 0)
+    {
+        bvh.nodes[nodeIdx].first = first;
+        bvh.nodes[nodeIdx].count = count;
+        return nodeIdx;
+    }
+
+    float lo = Axis(centroids.bmin, bestAxis), hi = Axis(centroids.bmax, bestAxis);
+    float scale = kSahBins / (hi - lo);
+    int* begin = &bvh.primIndices[first];
+    int* mid = std::partition(begin, begin + count, [&](int prim)
+    {
+        return std::min(kSahBins - 1, int((Axis(boxes[prim].Center(), bestAxis) - lo) * scale)) < bestBin;
+    });
+    int leftCount = int(mid - begin);
+
+    int children = int(bvh.nodes.size());
+    bvh.nodes.resize(children + 2);
+    bvh.nodes[nodeIdx].first = children;
+    bvh.nodes[nodeIdx].count = 0;
+    BuildNode(bvh, boxes, children, first, leftCount);
+    BuildNode(bvh, boxes, children + 1, first + leftCount, count - leftCount);
+    return nodeIdx;
+}
+
+void Bvh::Build(const Aabb* boxes, int count)
+{
+    nodes.clear();
+    primIndices.resize(count);
+    for (int i = 0; i < count; i++)
+        primIndices[i] = i;
+    if (count == 0)
+        return;
+    nodes.reserve(2 * count);
+    nodes.resize(1);
+    BuildNode(*this, boxes, 0, 0, count);
+    builtCost = SahCost();
+}
+
+void Bvh::Refit(const Aabb* boxes)
+{
+    for (int n = int(nodes.size()) - 1; n >= 0; n--)
+    {
+        BvhNode& node = nodes[n];
+        Aabb bounds;
+        if (node.count > 0)
+        {
+            for (int i = 0; i < node.count; i++)
+                bounds.Grow(boxes[primIndices[node.first + i]]);
+        }
+        else
+        {
+            bounds = nodes[node.first].bounds;
+            bounds.Grow(nodes[node.first + 1].bounds);
+        }
+        node.bounds = bounds;
+    }
+}
+
+float Bvh::SahCost() const
+{
+    if (nodes.empty())
+        return 0;
+    float rootArea = nodes[0].bounds.HalfArea();
+    float cost = 0;
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+        const BvhNode& node = nodes[n];
+        float p = node.bounds.HalfArea() / rootArea;
+        cost += p * (node.count > 0 ? kIntersectCost * node.count : kTraversalCost);
+    }
+    return cost;
+}
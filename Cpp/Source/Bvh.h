@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Maths.h"
+#include <algorithm>
+#include <vector>
+
+struct Aabb
+{
+    f3 bmin, bmax;
+
+    Aabb() : bmin(1.0e30f, 1.0e30f, 1.0e30f), bmax(-1.0e30f, -1.0e30f, -1.0e30f) {}
+    Aabb(const f3& mn, const f3& mx) : bmin(mn), bmax(mx) {}
+
+    void Grow(const Aabb& o)
+    {
+        bmin = f3(fminf(bmin.x, o.bmin.x), fminf(bmin.y, o.bmin.y), fminf(bmin.z, o.bmin.z));
+        bmax = f3(fmaxf(bmax.x, o.bmax.x), fmaxf(bmax.y, o.bmax.y), fmaxf(bmax.z, o.bmax.z));
+    }
+    f3 Center() const { return (bmin + bmax) * 0.5f; }
+    float HalfArea() const
+    {
+        f3 e = bmax - bmin;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+};
+
+inline Aabb SphereBounds(const Sphere& s)
+{
+    f3 r(s.radius, s.radius, s.radius);
+    return Aabb(s.center - r, s.center + r);
+}
+
+// interior nodes have count == 0 and their children at first and first+1;
+// leaves reference primIndices[first, first+count)
+struct BvhNode
+{
+    Aabb bounds;
+    int first;
+    int count;
+};
+
+// Binned SAH bounding volume hierarchy over primitive boxes. Children are always
+// stored after their parent, so Refit can update all nodes in one reverse sweep.
+struct Bvh
+{
+    std::vector<BvhNode> nodes;
+    std::vector<int> primIndices;
+    float builtCost = 0; // SAH cost right after the last Build
+
+    void Build(const Aabb* boxes, int count);
+    void Refit(const Aabb* boxes);
+    float SahCost() const;
+};
+
+inline bool HitAabb(const Aabb& b, const f3& orig, const f3& invDir, float tMin, float tMax)
+{
+    float tx0 = (b.bmin.x - orig.x) * invDir.x, tx1 = (b.bmax.x - orig.x) * invDir.x;
+    float ty0 = (b.bmin.y - orig.y) * invDir.y, ty1 = (b.bmax.y - orig.y) * invDir.y;
+    float tz0 = (b.bmin.z - orig.z) * invDir.z, tz1 = (b.bmax.z - orig.z) * invDir.z;
+    tMin = fmaxf(tMin, fmaxf(fminf(tx0, tx1), fmaxf(fminf(ty0, ty1), fminf(tz0, tz1))));
+    tMax = fminf(tMax, fminf(fmaxf(tx0, tx1), fminf(fmaxf(ty0, ty1), fmaxf(tz0, tz1))));
+    return tMin <= tMax;
+}
+
+// calls hitPrim(primIndex, closest) for every leaf primitive the ray may reach;
+// hitPrim shrinks closest when it finds a nearer hit
+template<typename F>
+void TraverseBvh(const Bvh& bvh, const Ray& r, float tMin, float& closest, const F& hitPrim)
+{
+    if (bvh.nodes.empty())
+        return;
+    const f3 invDir(1.0f / r.dir.x, 1.0f / r.dir.y, 1.0f / r.dir.z);
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const BvhNode& node = bvh.nodes[stack[--stackSize]];
+        if (!HitAabb(node.bounds, r.orig, invDir, tMin, closest))
+            continue;
+        if (node.count > 0)
+        {
+            for (int i = 0; i < node.count; i++)
+                hitPrim(bvh.primIndices[node.first + i], closest);
+        }
+        else
+        {
+            assert(stackSize + 2 <= 64);
+            stack[stackSize++] = node.first + 1;
+            stack[stackSize++] = node.first;
+        }
+    }
+}
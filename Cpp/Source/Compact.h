@@ -0,0 +1,161 @@
+#pragma once
+
+#include "Config.h"
+#include "Maths.h"
+#include <string.h>
+
+// Compact wavefront records: octahedral directions, primitive type and id packed
+// in 16 bits, and half-precision throughput. Selected with DO_COMPACT_WAVEFRONT in Config.h.
+
+inline uint16_t FloatToHalf(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, 4);
+    uint32_t sign = (x >> 16) & 0x8000;
+    int32_t exp = int32_t((x >> 23) & 0xFF) - 127 + 15;
+    uint32_t mant = x & 0x7FFFFF;
+    if (exp <= 0)
+    {
+        // flush denormals to zero, they never matter for radiance
+        return uint16_t(sign);
+    }
+    if (exp >= 31)
+    {
+        // clamp to the largest finite half
+        return uint16_t(sign | 0x7BFF);
+    }
+    // round to nearest, ties to even; a carry out of the mantissa bumps the exponent
+    uint32_t h = sign | (exp << 10) | (mant >> 13);
+    uint32_t rest = mant & 0x1FFF;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+        h++;
+    // rounding up past the largest finite half gives infinity, clamp it too
+    if ((h & 0x7C00) == 0x7C00)
+        h = sign | 0x7BFF;
+    return uint16_t(h);
+}
+
+inline float HalfToFloat(uint16_t h)
+{
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    uint32_t x = exp == 0 ? sign : (sign | ((exp - 15 + 127) << 23) | (mant << 13));
+    float f;
+    memcpy(&f, &x, 4);
+    return f;
+}
+
+inline float SignNotZero(float v) { return v >= 0 ? 1.0f : -1.0f; }
+
+// unit vector to two 16 bit snorm octahedral coordinates
+inline uint32_t OctEncode(const f3& n)
+{
+    AssertUnit(n);
+    float invL1 = 1.0f / (fabsf(n.x) + fabsf(n.y) + fabsf(n.z));
+    float u = n.x * invL1;
+    float v = n.y * invL1;
+    if (n.z < 0)
+    {
+        float pu = (1.0f - fabsf(v)) * SignNotZero(u);
+        float pv = (1.0f - fabsf(u)) * SignNotZero(v);
+        u = pu;
+        v = pv;
+    }
+    int32_t iu = int32_t(roundf(u * 32767.0f));
+    int32_t iv = int32_t(roundf(v * 32767.0f));
+    return (uint32_t(uint16_t(int16_t(iu))) << 16) | uint32_t(uint16_t(int16_t(iv)));
+}
+
+inline f3 OctDecode(uint32_t e)
+{
+    float u = float(int16_t(e >> 16)) / 32767.0f;
+    float v = float(int16_t(e & 0xFFFF)) / 32767.0f;
+    f3 n(u, v, 1.0f - fabsf(u) - fabsf(v));
+    if (n.z < 0)
+    {
+        float pu = (1.0f - fabsf(n.y)) * SignNotZero(n.x);
+        float pv = (1.0f - fabsf(n.x)) * SignNotZero(n.y);
+        n.x = pu;
+        n.y = pv;
+    }
+    return normalize(n);
+}
+
+struct PackedRay
+{
+    f3 orig;
+    uint32_t dir;
+};
+
+// the primitive type in the top 3 bits and its id in the low 13, all ones for a miss
+const int kPackedHitIdBits = 13;
+const uint16_t kPackedHitMiss = 0xFFFF;
+static_assert(kPrimTypeCount <= (1 << (16 - kPackedHitIdBits)), "primitive types don't fit a packed hit");
+
+#pragma pack(push, 2)
+struct PackedHit
+{
+    float t;
+    uint16_t typeId;
+};
+#pragma pack(pop)
+static_assert(sizeof(PackedHit) == 6, "packed hits grew");
+
+struct PackedSample
+{
+    uint16_t color[3];
+    uint16_t attenuation[3];
+};
+
+inline void PackF3(const f3& v, uint16_t* h) { h[0] = FloatToHalf(v.x); h[1] = FloatToHalf(v.y); h[2] = FloatToHalf(v.z); }
+inline f3 UnpackF3(const uint16_t* h) { return f3(HalfToFloat(h[0]), HalfToFloat(h[1]), HalfToFloat(h[2])); }
+
+// Load/Store overloads let the wavefront code stay agnostic of the record format
+
+inline Ray LoadRay(const Ray& r) { return r; }
+inline void StoreRay(Ray& dst, const Ray& r) { dst = r; }
+inline Ray LoadRay(const PackedRay& r) { return Ray(r.orig, OctDecode(r.dir)); }
+inline void StoreRay(PackedRay& dst, const Ray& r) { dst.orig = r.orig; dst.dir = OctEncode(r.dir); }
+
+inline Hit LoadHit(const Hit& h) { return h; }
+inline void StoreHit(Hit& dst, const Hit& h) { dst = h; }
+inline Hit LoadHit(const PackedHit& h)
+{
+    if (h.typeId == kPackedHitMiss)
+        return Hit(h.t, -1);
+    return Hit(h.t, h.typeId & ((1 << kPackedHitIdBits) - 1), h.typeId >> kPackedHitIdBits);
+}
+inline void StoreHit(PackedHit& dst, const Hit& h)
+{
+    // the primitive pools refuse to grow past this, see Primitives.h
+    assert(h.id < (1 << kPackedHitIdBits));
+    dst.t = h.t;
+    dst.typeId = h.id < 0 ? kPackedHitMiss : uint16_t((h.type << kPackedHitIdBits) | h.id);
+}
+
+inline Sample LoadSample(const Sample& s) { return s; }
+inline void StoreSample(Sample& dst, const Sample& s) { dst = s; }
+inline Sample LoadSample(const PackedSample& s)
+{
+    Sample r;
+    r.color = UnpackF3(s.color);
+    r.attenuation = UnpackF3(s.attenuation);
+    return r;
+}
+inline void StoreSample(PackedSample& dst, const Sample& s) { PackF3(s.color, dst.color); PackF3(s.attenuation, dst.attenuation); }
+
+// record formats used by the wavefront arrays
+
+#if DO_COMPACT_WAVEFRONT
+#if DO_CUDA_RENDER
+#error "compact wavefront records are only supported by the CPU renderer"
+#endif
+typedef PackedRay WaveRay;
+typedef PackedHit WaveHit;
+typedef PackedSample WaveSample;
+#else
+typedef Ray WaveRay;
+typedef Hit WaveHit;
+typedef Sample WaveSample;
+#endif // DO_COMPACT_WAVEFRONT
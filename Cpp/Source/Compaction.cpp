@@ -0,0 +1,96 @@
+#include "Compaction.h"
+#include "Parallel.h"
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DO_SSE2_COMPACTION 1
+#include <emmintrin.h>
+#else
+#define DO_SSE2_COMPACTION 0
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static inline int PopCount(uint32_t m) { return __popcnt(m); }
+static inline int LowestBit(uint32_t m) { unsigned long i; _BitScanForward(&i, m); return int(i); }
+#else
+static inline int PopCount(uint32_t m) { return __builtin_popcount(m); }
+static inline int LowestBit(uint32_t m) { return __builtin_ctz(m); }
+#endif
+
+const int kCompactChunk = 16 * 1024;
+
+#if DO_SSE2_COMPACTION
+// one bit per alive flag of the 16 flags starting at alive
+static inline uint32_t AliveMask16(const uint8_t* alive)
+{
+    __m128i f = _mm_loadu_si128((const __m128i*)alive);
+    return uint32_t(_mm_movemask_epi8(_mm_cmpgt_epi8(f, _mm_setzero_si128())));
+}
+#endif
+
+static int CountAlive(const uint8_t* alive, int begin, int end)
+{
+    int n = 0;
+    int i = begin;
+#if DO_SSE2_COMPACTION
+    for (; i + 16 <= end; i += 16)
+        n += PopCount(AliveMask16(alive + i));
+#endif
+    for (; i < end; i++)
+        n += alive[i] ? 1 : 0;
+    return n;
+}
+
+static void ScatterAlive(const uint8_t* alive, int begin, int end, int dst,
+    const WaveRay* raysIn, const int* indicesIn, WaveRay* raysOut, int* indicesOut)
+{
+    int i = begin;
+#if DO_SSE2_COMPACTION
+    for (; i + 16 <= end; i += 16)
+    {
+        // walk the set bits of the mask, which keeps the survivors in order
+        for (uint32_t m = AliveMask16(alive + i); m != 0; m &= m - 1)
+        {
+            int src = i + LowestBit(m);
+            raysOut[dst] = raysIn[src];
+            indicesOut[dst] = indicesIn[src];
+            dst++;
+        }
+    }
+#endif
+    for (; i < end; i++)
+    {
+        if (alive[i])
+        {
+            raysOut[dst] = raysIn[i];
+            indicesOut[dst] = indicesIn[i];
+            dst++;
+        }
+    }
+}
+
+int CompactSurvivors(const uint8_t* alive, int count,
+    const WaveRay* raysIn, const int* indicesIn,
+    WaveRay* raysOut, int* indicesOut)
+{
+    const int numChunks = ParallelChunkCount(count, kCompactChunk);
+    std::vector<int> offsets(numChunks + 1);
+
+    ParallelFor(count, kCompactChunk, [&](int chunk, int begin, int end)
+    {
+        offsets[chunk + 1] = CountAlive(alive, begin, end);
+    });
+
+    // exclusive prefix sum of the chunk counts
+    offsets[0] = 0;
+    for (int c = 0; c < numChunks; c++)
+        offsets[c + 1] += offsets[c];
+
+    ParallelFor(count, kCompactChunk, [&](int chunk, int begin, int end)
+    {
+        ScatterAlive(alive, begin, end, offsets[chunk], raysIn, indicesIn, raysOut, indicesOut);
+    });
+
+    return offsets[numChunks];
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "Compact.h"
+
+// Stable stream compaction of the surviving paths of a bounce: every ray whose
+// alive flag is set is copied, together with its sample index, to the front of
+// the output arrays in its original order. Runs as two parallel passes (count
+// per chunk, scatter per chunk) around a prefix sum of the chunk counts.
+// Returns the number of survivors.
+int CompactSurvivors(const uint8_t* alive, int count,
+    const WaveRay* raysIn, const int* indicesIn,
+    WaveRay* raysOut, int* indicesOut);
@@ -4,8 +4,67 @@
 #define kNumFrames 100
 
 #define DO_SAMPLES_PER_PIXEL 4
+// sample the emissive spheres through a light tree at diffuse hits, combined
+// with BSDF sampling through MIS
 #define DO_LIGHT_SAMPLING 0
 #define DO_PROGRESSIVE 1
 #define DO_MITSUBA_COMPARE 0
 
 #define DO_CUDA_RENDER 1
+
+// octahedral ray directions, 16-bit sphere ids, half-precision samples and a
+// 3-channel backbuffer; CPU only
+#define DO_COMPACT_WAVEFRONT 0
+
+#if DO_COMPACT_WAVEFRONT
+#define kBackbufferChannels 3
+#else
+#define kBackbufferChannels 4
+#endif
+
+// double-buffer the wavefront so the next frame's camera rays and first
+// bounces overlap the current frame's deep bounces and accumulation
+#define DO_PIPELINED_FRAMES 0
+
+// sort secondary rays by a Morton key of origin and direction before each
+// intersection batch, from kReorderMinDepth on
+#define DO_RAY_REORDER 0
+#define kReorderMinDepth 1
+// reorder every other frame at all depths and print per-depth sort cost
+// against the intersection time saved
+#define DO_REORDER_PROFILE 0
+
+// move the keyframed spheres every frame; each frame is then a separate image
+// instead of a progressive refinement. The BVH is refit, and rebuilt once its
+// SAH cost exceeds kRefitRebuildRatio times the cost of a fresh build.
+#define DO_ANIMATION 0
+#define kAnimationFrameTime (1.0f / 24.0f)
+#define kRefitRebuildRatio 1.5f
+
+// lowest fraction of the display resolution interactive rendering may drop to
+#define kMinResolutionScale 0.25f
+
+// back the wavefront arrays and the backbuffer with 2 MB pages where the OS
+// allows it; see Memory.h
+#define DO_HUGE_PAGES 1
+
+// on Linux hosts with several NUMA nodes, interleave the pages of those arrays
+// over all the nodes the process may use instead of leaving them wherever they
+// were first touched; see Memory.h
+#define DO_NUMA_INTERLEAVE 1
+
+// with an environment map (RenderOptions::envMap), importance sample it from
+// diffuse hits and combine that with BSDF sampling through MIS; 0 leaves the
+// environment to BSDF sampling alone
+#define DO_ENV_SAMPLING 1
+
+// guide diffuse bounces with a radiance distribution learned from the paths of
+// earlier frames, mixed half and half with cosine sampling; see PathGuide.h.
+// Render leaves it off with DO_PIPELINED_FRAMES or DO_ANIMATION. Off by default:
+// a guided frame costs about 40% more and only pays off in long renders
+#define DO_PATH_GUIDING 0
+
+// count cycles, instructions, LLC, branch, dTLB and remote NUMA node misses per
+// stage and bounce with Linux perf_event_open and print them per ray after
+// Render; see PerfCounters.h
+#define DO_PERF_COUNTERS 0
@@ -0,0 +1,282 @@
+#include "EnvMap.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static float Luminance(const f3& c)
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+// Vose's method; returns the sum of the weights. An all zero table samples
+// uniformly so that lookups stay valid.
+static double BuildAliasTable(const float* weights, int n, AliasEntry* table)
+{
+    double total = 0;
+    for (int i = 0; i < n; i++)
+        total += weights[i];
+    if (!(total > 0))
+    {
+        for (int i = 0; i < n; i++)
+        {
+            table[i].prob = 1;
+            table[i].alias = i;
+        }
+        return 0;
+    }
+
+    std::vector<double> scaled(n);
+    std::vector<int> small, large;
+    for (int i = 0; i < n; i++)
+    {
+        scaled[i] = weights[i] * n / total;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty())
+    {
+        int s = small.back(); small.pop_back();
+        int l = large.back();
+        table[s].prob = float(scaled[s]);
+        table[s].alias = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // whatever is left is 1 up to rounding
+    for (size_t i = 0; i < large.size(); i++)
+    {
+        table[large[i]].prob = 1;
+        table[large[i]].alias = large[i];
+    }
+    for (size_t i = 0; i < small.size(); i++)
+    {
+        table[small[i]].prob = 1;
+        table[small[i]].alias = small[i];
+    }
+    return total;
+}
+
+static int SampleAlias(const AliasEntry* table, int n, uint32_t& state)
+{
+    int i = std::min(n - 1, int(RandomFloat01(state) * n));
+    return RandomFloat01(state) < table[i].prob ? i : table[i].alias;
+}
+
+void InitEnvMap(EnvMap& env, int width, int height, f3* texels)
+{
+    env.width = width;
+    env.height = height;
+    env.texels = texels;
+    env.rows = new AliasEntry[height];
+    env.columns = new AliasEntry[width * height];
+    env.texelPdf = new float[width * height];
+
+    // rows near the poles cover less solid angle
+    std::vector<float> rowWeights(height), texelWeights(width);
+    double total = 0;
+    for (int y = 0; y < height; y++)
+    {
+        float sinTheta = sinf((y + 0.5f) / height * kPI);
+        for (int x = 0; x < width; x++)
+        {
+            texelWeights[x] = Luminance(texels[y * width + x]) * sinTheta;
+            env.texelPdf[y * width + x] = texelWeights[x];
+        }
+        rowWeights[y] = float(BuildAliasTable(texelWeights.data(), width, env.columns + y * width));
+        total += rowWeights[y];
+    }
+    BuildAliasTable(rowWeights.data(), height, env.rows);
+
+    env.canSample = total > 0;
+    float invTotal = env.canSample ? float(1.0 / total) : 0.0f;
+    for (int i = 0; i < width * height; i++)
+        env.texelPdf[i] *= invTotal;
+}
+
+void FreeEnvMap(EnvMap& env)
+{
+    delete[] env.texels;
+    delete[] env.rows;
+    delete[] env.columns;
+    delete[] env.texelPdf;
+}
+
+static int EnvMapTexel(const EnvMap& env, const f3& dir, float& sinTheta)
+{
+    float cosTheta = std::min(1.0f, std::max(-1.0f, dir.y));
+    sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    float u = (atan2f(dir.x, -dir.z) + kPI) / (2.0f * kPI);
+    float v = acosf(cosTheta) / kPI;
+    int x = std::min(env.width - 1, std::max(0, int(u * env.width)));
+    int y = std::min(env.height - 1, std::max(0, int(v * env.height)));
+    return y * env.width + x;
+}
+
+f3 EnvMapRadiance(const EnvMap& env, const f3& dir)
+{
+    float sinTheta;
+    return env.texels[EnvMapTexel(env, dir, sinTheta)];
+}
+
+float EnvMapPdf(const EnvMap& env, const f3& dir)
+{
+    float sinTheta;
+    int t = EnvMapTexel(env, dir, sinTheta);
+    if (!env.canSample || sinTheta <= 0)
+        return 0;
+    // uniform within the texel's (phi, theta) rectangle
+    return env.texelPdf[t] * env.width * env.height / (2.0f * kPI * kPI * sinTheta);
+}
+
+f3 SampleEnvMap(const EnvMap& env, uint32_t& state, f3& dir, float& pdf)
+{
+    int y = SampleAlias(env.rows, env.height, state);
+    int x = SampleAlias(env.columns + y * env.width, env.width, state);
+    float theta = (y + RandomFloat01(state)) / env.height * kPI;
+    float phi = (x + RandomFloat01(state)) / env.width * 2.0f * kPI - kPI;
+    float sinTheta = sinf(theta);
+    dir = f3(sinTheta * sinf(phi), cosf(theta), -sinTheta * cosf(phi));
+    pdf = sinTheta > 0 ? env.texelPdf[y * env.width + x] * env.width * env.height / (2.0f * kPI * kPI * sinTheta) : 0;
+    return env.texels[y * env.width + x];
+}
+
+// Portable float map: "PF" (rgb) or "Pf" (grey), a negative scale means little
+// endian, rows are stored bottom up
+static f3* LoadPfm(FILE* f, int& width, int& height)
+{
+    char type[3] = {};
+    float scale;
+    if (fscanf(f, "%2s %d %d %f", type, &width, &height, &scale) != 4 || fgetc(f) == EOF ||
+        type[0] != 'P' || (type[1] != 'F' && type[1] != 'f') || width <= 0 || height <= 0)
+        return NULL;
+    const int channels = type[1] == 'F' ? 3 : 1;
+    std::vector<float> data(size_t(width) * height * channels);
+    if (fread(data.data(), sizeof(float), data.size(), f) != data.size())
+        return NULL;
+    if (scale > 0)
+    {
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            uint32_t v;
+            memcpy(&v, &data[i], 4);
+            v = (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+            memcpy(&data[i], &v, 4);
+        }
+    }
+    f3* texels = new f3[width * height];
+    for (int y = 0; y < height; y++)
+    {
+        const float* src = &data[size_t(height - 1 - y) * width * channels];
+        for (int x = 0; x < width; x++, src += channels)
+            texels[y * width + x] = channels == 3 ? f3(src[0], src[1], src[2]) : f3(src[0], src[0], src[0]);
+    }
+    return texels;
+}
+
+// one RGBE scanline, run length encoded or flat
+static bool ReadHdrScanline(FILE* f, int width, uint8_t* rgbe)
+{
+    int c[4];
+    for (int i = 0; i < 4; i++)
+        c[i] = fgetc(f);
+    if (c[3] == EOF)
+        return false;
+    if (width < 8 || width > 0x7FFF || c[0] != 2 || c[1] != 2 || (c[2] & 0x80))
+    {
+        for (int i = 0; i < 4; i++)
+            rgbe[i] = uint8_t(c[i]);
+        return fread(rgbe + 4, 4, width - 1, f) == size_t(width - 1);
+    }
+    if (((c[2] << 8) | c[3]) != width)
+        return false;
+    for (int ch = 0; ch < 4; ch++)
+    {
+        for (int x = 0; x < width;)
+        {
+            int count = fgetc(f);
+            if (count == EOF || count == 0)
+                return false;
+            if (count > 128)
+            {
+                count -= 128;
+                int v = fgetc(f);
+                if (v == EOF || x + count > width)
+                    return false;
+                for (; count > 0; count--)
+                    rgbe[4 * x++ + ch] = uint8_t(v);
+            }
+            else
+            {
+                if (x + count > width)
+                    return false;
+                for (; count > 0; count--)
+                {
+                    int v = fgetc(f);
+                    if (v == EOF)
+                        return false;
+                    rgbe[4 * x++ + ch] = uint8_t(v);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Radiance RGBE with the standard -Y h +X w orientation
+static f3* LoadHdr(FILE* f, int& width, int& height)
+{
+    char line[256];
+    if (fgets(line, sizeof(line), f) == NULL || strncmp(line, "#?", 2) != 0)
+        return NULL;
+    while (fgets(line, sizeof(line), f) != NULL && line[0] != '\n')
+    {
+        if (strncmp(line, "FORMAT=", 7) == 0 && strncmp(line + 7, "32-bit_rle_rgbe", 15) != 0)
+            return NULL;
+    }
+    if (fscanf(f, "-Y %d +X %d", &height, &width) != 2 || fgetc(f) != '\n' || width <= 0 || height <= 0)
+        return NULL;
+
+    std::vector<uint8_t> rgbe(size_t(width) * 4);
+    f3* texels = new f3[width * height];
+    for (int y = 0; y < height; y++)
+    {
+        if (!ReadHdrScanline(f, width, rgbe.data()))
+        {
+            delete[] texels;
+            return NULL;
+        }
+        for (int x = 0; x < width; x++)
+        {
+            const uint8_t* p = &rgbe[4 * x];
+            float s = p[3] ? ldexpf(1.0f, int(p[3]) - 136) : 0.0f;
+            texels[y * width + x] = f3(p[0] * s, p[1] * s, p[2] * s);
+        }
+    }
+    return texels;
+}
+
+bool LoadEnvMap(const char* path, EnvMap& env)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        printf("can't open environment map %s\n", path);
+        return false;
+    }
+    int width = 0, height = 0;
+    int c = fgetc(f);
+    ungetc(c, f);
+    f3* texels = c == 'P' ? LoadPfm(f, width, height) : LoadHdr(f, width, height);
+    fclose(f);
+    if (texels == NULL)
+    {
+        printf("environment map %s isn't a PFM or Radiance HDR file this loader understands\n", path);
+        return false;
+    }
+    InitEnvMap(env, width, height, texels);
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Maths.h"
+
+// one bucket of an alias table: keep the bucket with probability prob,
+// otherwise take alias
+struct AliasEntry
+{
+    float prob;
+    int alias;
+};
+
+// Lat-long HDR environment. Row 0 looks straight up (+y), columns go around y
+// starting at -z. Texels are piecewise constant; importance sampling picks a row
+// from the marginal alias table and a column from that row's conditional one, so
+// each sample costs two table lookups whatever the resolution.
+struct EnvMap
+{
+    int width, height;
+    f3* texels;
+    AliasEntry* rows;    // height entries, weighted by row luminance times sin(theta)
+    AliasEntry* columns; // width entries per row
+    float* texelPdf;     // discrete probability of every texel, for MIS
+    bool canSample;      // false for an all black map
+};
+
+// Loads a PFM (color or greyscale) or a Radiance .hdr file and builds the
+// sampling tables. Prints the reason and returns false on failure.
+bool LoadEnvMap(const char* path, EnvMap& env);
+// takes ownership of width * height texels, row 0 at the top
+void InitEnvMap(EnvMap& env, int width, int height, f3* texels);
+void FreeEnvMap(EnvMap& env);
+
+f3 EnvMapRadiance(const EnvMap& env, const f3& dir);
+// solid angle density SampleEnvMap draws dir with
+float EnvMapPdf(const EnvMap& env, const f3& dir);
+// returns the radiance arriving from the sampled direction
+f3 SampleEnvMap(const EnvMap& env, uint32_t& state, f3& dir, float& pdf);
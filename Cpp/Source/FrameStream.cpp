@@ -0,0 +1,217 @@
+#include "FrameStream.h"
+#include "Parallel.h"
+#include "Timer.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+const int kStreamRowChunk = 8;
+
+struct StreamSlot
+{
+    std::vector<uint8_t> bytes;
+    bool queued;
+};
+
+struct FrameStream
+{
+    FILE* file;
+    FrameStreamFormat format;
+    int width, height;
+    TonemapOptions tonemap;
+    std::vector<uint8_t> rgb; // Y4M only, the 8 bit frame before the YUV conversion
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    StreamSlot slots[kStreamQueueFrames];
+    int nextPush, nextWrite; // slot indices, in frame order
+    bool closing, failed;
+    std::thread writer;
+
+    int framesPushed, framesWaited;
+    double waitSeconds;
+};
+
+static void WriterLoop(FrameStream* s)
+{
+    std::unique_lock<std::mutex> lock(s->mutex);
+    while (true)
+    {
+        s->changed.wait(lock, [s] { return s->closing || s->slots[s->nextWrite].queued; });
+        StreamSlot& slot = s->slots[s->nextWrite];
+        if (!slot.queued)
+            return;
+        lock.unlock();
+        bool ok = true;
+        if (s->format == kStreamY4m)
+            ok = fputs("FRAME\n", s->file) >= 0;
+        ok = ok && fwrite(slot.bytes.data(), 1, slot.bytes.size(), s->file) == slot.bytes.size() && fflush(s->file) == 0;
+        lock.lock();
+        if (!ok)
+            s->failed = true;
+        slot.queued = false;
+        s->nextWrite = (s->nextWrite + 1) % kStreamQueueFrames;
+        s->changed.notify_all();
+    }
+}
+
+// full range R'G'B' to limited range BT.709 Y'CbCr
+static inline float LumaOf(float r, float g, float b) { return 0.2126f * r + 0.7152f * g + 0.0722f * b; }
+static inline uint8_t LimitedLuma(float y) { return uint8_t(16.0f + y * (219.0f / 255.0f) + 0.5f); }
+static inline uint8_t LimitedChroma(float c) { return uint8_t(128.0f + c * (224.0f / 255.0f) + 0.5f); }
+
+// planar 4:2:0 from the top down RGB frame; chroma from the average of each 2x2
+// block, edge pixels repeated for odd sizes
+static void RgbToYuv420(const uint8_t* rgb, int width, int height, uint8_t* yuv)
+{
+    const int cw = (width + 1) / 2, ch = (height + 1) / 2;
+    uint8_t* yPlane = yuv;
+    uint8_t* uPlane = yuv + size_t(width) * height;
+    uint8_t* vPlane = uPlane + size_t(cw) * ch;
+    ParallelFor(ch, kStreamRowChunk, [&](int chunk, int begin, int end)
+    {
+        for (int cy = begin; cy < end; cy++)
+        {
+            const int y0 = cy * 2, y1 = std::min(y0 + 1, height - 1);
+            for (int cx = 0; cx < cw; cx++)
+            {
+                const int x0 = cx * 2, x1 = std::min(x0 + 1, width - 1);
+                const int xs[4] = { x0, x1, x0, x1 }, ys[4] = { y0, y0, y1, y1 };
+                float r = 0, g = 0, b = 0;
+                for (int i = 0; i < 4; i++)
+                {
+                    const uint8_t* p = rgb + (size_t(ys[i]) * width + xs[i]) * 3;
+                    yPlane[size_t(ys[i]) * width + xs[i]] = LimitedLuma(LumaOf(p[0], p[1], p[2]));
+                    r += p[0];
+                    g += p[1];
+                    b += p[2];
+                }
+                r *= 0.25f;
+                g *= 0.25f;
+                b *= 0.25f;
+                const float luma = LumaOf(r, g, b);
+                uPlane[size_t(cy) * cw + cx] = LimitedChroma((b - luma) / 1.8556f);
+                vPlane[size_t(cy) * cw + cx] = LimitedChroma((r - luma) / 1.5748f);
+            }
+        }
+    });
+}
+
+FrameStream* OpenFrameStream(const char* path, FrameStreamFormat format, int width, int height, int fps, const TonemapOptions& tonemap)
+{
+    FILE* file = NULL;
+    if (strcmp(path, "-") == 0)
+    {
+        // keep the stream on its own descriptor and point stdout at stderr, so
+        // the log can't end up in the middle of a frame
+        fflush(stdout);
+#if defined(_WIN32)
+        int fd = _dup(_fileno(stdout));
+        if (fd >= 0 && _dup2(_fileno(stderr), _fileno(stdout)) == 0)
+        {
+            _setmode(fd, _O_BINARY);
+            file = _fdopen(fd, "wb");
+        }
+#else
+        int fd = dup(STDOUT_FILENO);
+        if (fd >= 0 && dup2(STDERR_FILENO, STDOUT_FILENO) >= 0)
+            file = fdopen(fd, "wb");
+#endif
+    }
+    else
+        file = fopen(path, "wb");
+    if (file == NULL)
+        return NULL;
+#if !defined(_WIN32)
+    // a reader that goes away shows up as a failed write instead of killing us
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    FrameStream* s = new FrameStream();
+    s->file = file;
+    s->format = format;
+    s->width = width;
+    s->height = height;
+    s->tonemap = tonemap;
+    size_t frameBytes;
+    if (format == kStreamY4m)
+    {
+        fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height, fps);
+        s->rgb.resize(size_t(width) * height * 3);
+        frameBytes = size_t(width) * height + 2 * size_t((width + 1) / 2) * ((height + 1) / 2);
+    }
+    else
+        frameBytes = size_t(width) * height * 3 * sizeof(uint16_t);
+    for (int i = 0; i < kStreamQueueFrames; i++)
+    {
+        s->slots[i].bytes.resize(frameBytes);
+        s->slots[i].queued = false;
+    }
+    s->nextPush = s->nextWrite = 0;
+    s->closing = s->failed = false;
+    s->framesPushed = s->framesWaited = 0;
+    s->waitSeconds = 0;
+    s->writer = std::thread(WriterLoop, s);
+    return s;
+}
+
+bool PushStreamFrame(FrameStream* s, const float* backbuffer, int channels)
+{
+    std::unique_lock<std::mutex> lock(s->mutex);
+    StreamSlot& slot = s->slots[s->nextPush];
+    if (slot.queued && !s->failed)
+    {
+        const double t0 = NowSeconds();
+        s->changed.wait(lock, [s, &slot] { return !slot.queued || s->failed; });
+        s->framesWaited++;
+        s->waitSeconds += NowSeconds() - t0;
+    }
+    if (s->failed)
+        return false;
+    lock.unlock();
+
+    // the writer never touches a slot that isn't queued
+    if (s->format == kStreamY4m)
+    {
+        TonemapImage(backbuffer, s->width, s->height, channels, s->tonemap, s->rgb.data());
+        RgbToYuv420(s->rgb.data(), s->width, s->height, slot.bytes.data());
+    }
+    else
+        TonemapImage16(backbuffer, s->width, s->height, channels, s->tonemap, (uint16_t*)slot.bytes.data());
+
+    lock.lock();
+    slot.queued = true;
+    s->nextPush = (s->nextPush + 1) % kStreamQueueFrames;
+    s->framesPushed++;
+    s->changed.notify_all();
+    return true;
+}
+
+bool CloseFrameStream(FrameStream* s)
+{
+    {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        s->closing = true;
+        s->changed.notify_all();
+    }
+    s->writer.join();
+    bool ok = !s->failed && fclose(s->file) == 0;
+    if (s->failed)
+        fclose(s->file);
+    printf("frame stream: %d frames, waited for the reader before %d of them (%.2fs)%s\n",
+        s->framesPushed, s->framesWaited, s->waitSeconds, ok ? "" : ", writing failed");
+    delete s;
+    return ok;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Tonemap.h"
+
+// Streams rendered frames as raw video to stdout or a FIFO, for an external
+// encoder to read, e.g.
+//
+//   TestCpu -stream=- | ffmpeg -i - out.mp4                  (Y4M)
+//   TestCpu -stream=- -streamformat=rgb48 | ffmpeg -f rawvideo -pix_fmt rgb48le -s 1280x720 -i - out.mkv
+//
+// Frames are converted on the rendering thread into one of kStreamQueueFrames
+// preallocated slots and written out by a writer thread. When every slot is
+// still queued, PushStreamFrame waits for the writer, so a slow encoder slows
+// rendering down instead of growing memory.
+const int kStreamQueueFrames = 4;
+
+enum FrameStreamFormat
+{
+    kStreamY4m,   // YUV4MPEG2, 8 bit 4:2:0 BT.709 limited range
+    kStreamRgb48, // headerless RGB, 16 bits per channel in native byte order
+};
+
+struct FrameStream;
+
+// path "-" is stdout, which then carries nothing but the stream: anything
+// printed afterwards goes to stderr. Opening a FIFO waits for its reader.
+// NULL if the file can't be opened.
+FrameStream* OpenFrameStream(const char* path, FrameStreamFormat format, int width, int height, int fps, const TonemapOptions& tonemap);
+
+// Queues a width x height backbuffer with channels floats per pixel, bottom row
+// first. False once a write failed, e.g. because the encoder went away; later
+// frames are dropped then.
+bool PushStreamFrame(FrameStream* stream, const float* backbuffer, int channels);
+
+// Writes out everything still queued and closes the file; false if any write
+// failed.
+bool CloseFrameStream(FrameStream* stream);
@@ -0,0 +1,180 @@
+#include "LightTree.h"
+
+static float Axis(const f3& v, int axis) { return axis == 0 ? v.x : (axis == 1 ? v.y : v.z); }
+
+// Splits at the median centroid along the widest axis, which keeps the tree
+// balanced so trails stay short.
+static void BuildLightNode(LightTree& tree, const Sphere* spheres, const float* power, int nodeIdx, int first, int count, uint32_t trail, int depth)
+{
+    Aabb bounds, centroids;
+    float total = 0;
+    for (int i = first; i < first + count; i++)
+    {
+        const Sphere& s = spheres[tree.lightSpheres[i]];
+        bounds.Grow(SphereBounds(s));
+        centroids.Grow(Aabb(s.center, s.center));
+        total += power[tree.lightSpheres[i]];
+    }
+    tree.nodes[nodeIdx].bounds = bounds;
+    tree.nodes[nodeIdx].power = total;
+
+    if (count == 1)
+    {
+        tree.nodes[nodeIdx].first = first;
+        tree.nodes[nodeIdx].count = 1;
+        tree.trails[first] = trail;
+        return;
+    }
+    assert(depth < 32);
+
+    f3 extent = centroids.bmax - centroids.bmin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    int* begin = &tree.lightSpheres[first];
+    int half = count / 2;
+    std::nth_element(begin, begin + half, begin + count, [&](int a, int b)
+    {
+        return Axis(spheres[a].center, axis) < Axis(spheres[b].center, axis);
+    });
+
+    int children = int(tree.nodes.size());
+    tree.nodes.resize(children + 2);
+    tree.nodes[nodeIdx].first = children;
+    tree.nodes[nodeIdx].count = 0;
+    BuildLightNode(tree, spheres, power, children, first, half, trail, depth + 1);
+    BuildLightNode(tree, spheres, power, children + 1, first + half, count - half, trail | (1u << depth), depth + 1);
+}
+
+void LightTree::Build(const Sphere* spheres, const float* power, int count)
+{
+    nodes.clear();
+    lightSpheres.clear();
+    sphereLights.assign(count, -1);
+    for (int i = 0; i < count; i++)
+    {
+        if (power[i] > 0)
+            lightSpheres.push_back(i);
+    }
+    if (lightSpheres.empty())
+        return;
+
+    trails.resize(lightSpheres.size());
+    nodes.resize(1);
+    BuildLightNode(*this, spheres, power, 0, 0, int(lightSpheres.size()), 0, 0);
+    for (size_t i = 0; i < lightSpheres.size(); i++)
+        sphereLights[lightSpheres[i]] = int(i);
+}
+
+// how much the lights below a node may contribute to a diffuse receiver
+static float NodeImportance(const LightNode& node, const f3& p, const f3& n)
+{
+    const f3 d = node.bounds.Center() - p;
+    const float radius = 0.5f * (node.bounds.bmax - node.bounds.bmin).length();
+    const float dist2 = dot(d, d);
+    // inside the node's bounding sphere any direction may reach a light, and the
+    // distance is only known to be below the radius
+    if (dist2 <= radius * radius)
+        return node.power / std::max(radius * radius, 1.0e-8f);
+
+    const float dist = sqrtf(dist2);
+    const float cosTheta = dot(n, d) / dist;
+    const float sinBound = radius / dist;
+    const float cosBound = sqrtf(1.0f - sinBound * sinBound);
+    // cosine of the smallest angle between n and a direction into the bounding sphere
+    float cosReceiver = 1.0f;
+    if (cosTheta < cosBound)
+    {
+        float sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+        cosReceiver = cosTheta * cosBound + sinTheta * sinBound;
+        if (cosReceiver <= 0)
+            return 0;
+    }
+    return node.power * cosReceiver / dist2;
+}
+
+int SampleLightTree(const LightTree& tree, const f3& p, const f3& n, float u, float& pmf)
+{
+    pmf = 1;
+    if (tree.Empty())
+        return -1;
+    int idx = 0;
+    while (tree.nodes[idx].count == 0)
+    {
+        const int first = tree.nodes[idx].first;
+        float i0 = NodeImportance(tree.nodes[first], p, n);
+        float i1 = NodeImportance(tree.nodes[first + 1], p, n);
+        if (!(i0 + i1 > 0))
+            return -1;
+        // reuse the random number for every level by rescaling it into the picked range
+        float p0 = i0 / (i0 + i1);
+        if (u < p0)
+        {
+            u = u / p0;
+            pmf *= p0;
+            idx = first;
+        }
+        else
+        {
+            u = (u - p0) / (1.0f - p0);
+            pmf *= 1.0f - p0;
+            idx = first + 1;
+        }
+        u = std::min(u, 0.99999994f);
+    }
+    return tree.lightSpheres[tree.nodes[idx].first];
+}
+
+float LightTreePmf(const LightTree& tree, const f3& p, const f3& n, int sphere)
+{
+    if (tree.Empty() || tree.sphereLights[sphere] < 0)
+        return 0;
+    uint32_t trail = tree.trails[tree.sphereLights[sphere]];
+    float pmf = 1;
+    int idx = 0;
+    while (tree.nodes[idx].count == 0)
+    {
+        const int first = tree.nodes[idx].first;
+        float i0 = NodeImportance(tree.nodes[first], p, n);
+        float i1 = NodeImportance(tree.nodes[first + 1], p, n);
+        if (!(i0 + i1 > 0))
+            return 0;
+        const int bit = trail & 1;
+        pmf *= (bit ? i1 : i0) / (i0 + i1);
+        idx = first + bit;
+        trail >>= 1;
+    }
+    return pmf;
+}
+
+bool SampleSphereCone(const Sphere& s, const f3& p, uint32_t& state, f3& dir, float& pdf)
+{
+    const f3 d = s.center - p;
+    const float dist2 = dot(d, d);
+    const float r2 = s.radius * s.radius;
+    if (dist2 <= r2)
+        return false;
+    // 1 - cos(thetaMax) without the cancellation for small, distant spheres
+    const float sin2Max = r2 / dist2;
+    const float oneMinusCosMax = sin2Max / (1.0f + sqrtf(1.0f - sin2Max));
+    const float cosTheta = 1.0f - RandomFloat01(state) * oneMinusCosMax;
+    const float sinTheta = sqrtf(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    const float phi = RandomFloat01(state) * 2.0f * kPI;
+
+    const f3 w = d * (1.0f / sqrtf(dist2));
+    const f3 a = fabsf(w.x) > 0.9f ? f3(0, 1, 0) : f3(1, 0, 0);
+    const f3 u = normalize(cross(a, w));
+    const f3 v = cross(w, u);
+    dir = normalize(u * (cosf(phi) * sinTheta) + v * (sinf(phi) * sinTheta) + w * cosTheta);
+    pdf = 1.0f / (2.0f * kPI * oneMinusCosMax);
+    return true;
+}
+
+float SphereConePdf(const Sphere& s, const f3& p)
+{
+    const f3 d = s.center - p;
+    const float dist2 = dot(d, d);
+    const float r2 = s.radius * s.radius;
+    if (dist2 <= r2)
+        return 0;
+    const float sin2Max = r2 / dist2;
+    return 1.0f / (2.0f * kPI * sin2Max / (1.0f + sqrtf(1.0f - sin2Max)));
+}
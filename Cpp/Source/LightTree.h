@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Bvh.h"
+
+// interior nodes have count == 0 and their children at first and first+1;
+// leaves hold the single light first
+struct LightNode
+{
+    Aabb bounds;
+    float power;
+    int first;
+    int count;
+};
+
+// Light hierarchy over the emissive spheres. Sampling walks down from the root
+// and picks each child by its importance for the shading point: power over
+// squared distance, times a bound on the receiver's cosine toward the node's
+// box. Spheres emit in every direction, so there is no emitter side cone to
+// bound. The cost per sample grows with the depth of the tree, not the number
+// of lights.
+struct LightTree
+{
+    std::vector<LightNode> nodes;
+    std::vector<int> lightSpheres; // sphere index of every light
+    std::vector<int> sphereLights; // light index of every sphere, -1 if it doesn't emit
+    std::vector<uint32_t> trails;  // per light, bit d set when its path takes the second child at depth d
+
+    // power is proportional to the flux of each sphere, 0 for non emitters
+    void Build(const Sphere* spheres, const float* power, int count);
+    bool Empty() const { return nodes.empty(); }
+};
+
+// picks a light for a diffuse receiver at p with normal n; returns its sphere
+// index and the probability of picking it, or -1 when no light can contribute
+int SampleLightTree(const LightTree& tree, const f3& p, const f3& n, float u, float& pmf);
+// probability that SampleLightTree picks the given sphere from p, n
+float LightTreePmf(const LightTree& tree, const f3& p, const f3& n, int sphere);
+
+// uniform direction within the cone a sphere subtends from p; false when p is inside
+bool SampleSphereCone(const Sphere& s, const f3& p, uint32_t& state, f3& dir, float& pdf);
+float SphereConePdf(const Sphere& s, const f3& p);
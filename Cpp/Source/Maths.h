@@ -79,12 +79,24 @@ struct Ray
 };
 
 
+// what a ray hit; see Primitives.h for everything but spheres
+enum PrimitiveType
+{
+    kPrimSphere,
+    kPrimPlane,
+    kPrimBox,
+    kPrimDisk,
+    kPrimQuad,
+    kPrimTypeCount
+};
+
 struct Hit
 {
     Hit() {}
-    Hit(float _t, int _id) :t(_t), id(_id) {}
+    Hit(float _t, int _id, int _type = kPrimSphere) :t(_t), id(_id), type(_type) {}
     float t;
-    int id = -1;
+    int id = -1; // index into the pool of its type, -1 for a miss
+    int type = kPrimSphere;
 };
 
 struct Sample
@@ -142,6 +154,21 @@ struct Camera
         f3 offset = u * rd.x + v * rd.y;
         return Ray(origin + offset, normalize(lowerLeftCorner + s*horizontal + t*vertical - origin - offset));
     }
+
+    // screen coordinates (s, t) of a world position, the inverse of GetRay
+    // for the lens centre; false when the point is behind the camera
+    bool Project(const f3& p, float& s, float& t) const
+    {
+        f3 d = p - origin;
+        float dw = -dot(d, w);
+        if (dw <= 0)
+            return false;
+        float planeDist = -dot(lowerLeftCorner - origin, w);
+        f3 q = origin + d * (planeDist / dw) - lowerLeftCorner;
+        s = dot(q, horizontal) / horizontal.sqLength();
+        t = dot(q, vertical) / vertical.sqLength();
+        return true;
+    }
     
     f3 origin;
     f3 lowerLeftCorner;
@@ -0,0 +1,228 @@
+#include "Memory.h"
+#include "Config.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+const size_t kHugePageSize = 2 * 1024 * 1024;
+// smaller allocations aren't worth a huge page of their own
+const size_t kMinHugeBytes = kHugePageSize / 2;
+
+enum LargeBacking
+{
+    kBackingHuge,        // explicit huge or large pages
+    kBackingTransparent, // regular mapping with transparent huge pages requested
+    kBackingRegular,
+    kBackingCount
+};
+
+static std::atomic<size_t> s_AllocatedBytes[kBackingCount];
+static std::atomic<size_t> s_InterleavedBytes;
+
+static size_t RoundUp(size_t v, size_t align)
+{
+    return (v + align - 1) / align * align;
+}
+
+#if defined(_WIN32)
+
+// large pages need SeLockMemoryPrivilege; try once to enable it for the process
+static size_t LargePageSize()
+{
+    static size_t s_Size = 0;
+    static bool s_Checked = false;
+    if (s_Checked)
+        return s_Size;
+    s_Checked = true;
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+        return 0;
+    TOKEN_PRIVILEGES tp;
+    tp.PrivilegeCount = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    if (LookupPrivilegeValueA(NULL, "SeLockMemoryPrivilege", &tp.Privileges[0].Luid) &&
+        AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL) && GetLastError() == ERROR_SUCCESS)
+        s_Size = GetLargePageMinimum();
+    CloseHandle(token);
+    return s_Size;
+}
+
+static void* MapPages(size_t bytes, LargeBacking& backing)
+{
+    void* p = NULL;
+    size_t largePage = DO_HUGE_PAGES && bytes >= kMinHugeBytes ? LargePageSize() : 0;
+    if (largePage != 0)
+    {
+        p = VirtualAlloc(NULL, RoundUp(bytes, largePage), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        backing = kBackingHuge;
+    }
+    if (p == NULL)
+    {
+        p = VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        backing = kBackingRegular;
+    }
+    return p;
+}
+
+static void UnmapPages(void* p, size_t bytes)
+{
+    VirtualFree(p, 0, MEM_RELEASE);
+}
+
+#else
+
+// mappings are always sized in whole huge pages, so unmapping doesn't need to
+// know which kind of page backs them
+static void* MapPages(size_t bytes, LargeBacking& backing)
+{
+    void* p = MAP_FAILED;
+    size_t mapped = RoundUp(bytes, kHugePageSize);
+#if DO_HUGE_PAGES && defined(MAP_HUGETLB)
+    if (bytes >= kMinHugeBytes)
+    {
+        p = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        backing = kBackingHuge;
+    }
+#endif
+    if (p == MAP_FAILED)
+    {
+        p = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+        backing = kBackingRegular;
+#if DO_HUGE_PAGES && defined(MADV_HUGEPAGE)
+        if (bytes >= kMinHugeBytes && madvise(p, mapped, MADV_HUGEPAGE) == 0)
+            backing = kBackingTransparent;
+#endif
+    }
+    return p;
+}
+
+static void UnmapPages(void* p, size_t bytes)
+{
+    munmap(p, RoundUp(bytes, kHugePageSize));
+}
+
+#endif
+
+#if DO_NUMA_INTERLEAVE && defined(__linux__)
+
+// straight system calls, so the build doesn't need libnuma; values from numaif.h
+const int kMpolInterleave = 3;
+const unsigned long kMpolMemsAllowed = 1 << 2;
+const int kMaxNumaNodes = 1024;
+const int kMaskWordBits = 8 * sizeof(unsigned long);
+
+struct NumaNodes
+{
+    unsigned long mask[kMaxNumaNodes / kMaskWordBits];
+    int count;
+};
+
+// the nodes this process may allocate on, looked up once; count is 0 when the
+// kernel has no NUMA support
+static const NumaNodes& AllowedNodes()
+{
+    static NumaNodes s_Nodes;
+    static bool s_Init = [] {
+        int mode;
+        memset(&s_Nodes, 0, sizeof(s_Nodes));
+        if (syscall(SYS_get_mempolicy, &mode, s_Nodes.mask, kMaxNumaNodes, NULL, kMpolMemsAllowed) != 0)
+            memset(s_Nodes.mask, 0, sizeof(s_Nodes.mask));
+        for (int i = 0; i < kMaxNumaNodes; i++)
+            s_Nodes.count += (s_Nodes.mask[i / kMaskWordBits] >> (i % kMaskWordBits)) & 1;
+        return true;
+    }();
+    (void)s_Init;
+    return s_Nodes;
+}
+
+// has to happen before the pages are touched; false when there's only one node
+// or the kernel refuses
+static bool InterleavePages(void* p, size_t bytes)
+{
+    const NumaNodes& nodes = AllowedNodes();
+    if (nodes.count < 2)
+        return false;
+    // mbind wants one more than the number of bits in the mask
+    return syscall(SYS_mbind, p, RoundUp(bytes, kHugePageSize), kMpolInterleave, nodes.mask, kMaxNumaNodes + 1, 0) == 0;
+}
+
+static int NumaNodeCount()
+{
+    return AllowedNodes().count;
+}
+
+#else
+
+static bool InterleavePages(void* p, size_t bytes)
+{
+    return false;
+}
+
+static int NumaNodeCount()
+{
+    return 0;
+}
+
+#endif
+
+void* AllocLarge(size_t bytes, size_t touchChunkBytes)
+{
+    if (bytes == 0)
+        return NULL;
+    LargeBacking backing = kBackingRegular;
+    char* p = (char*)MapPages(bytes, backing);
+    if (p == NULL)
+    {
+        printf("failed to allocate %.1fMB\n", bytes / (1024.0 * 1024.0));
+        abort();
+    }
+    s_AllocatedBytes[backing] += bytes;
+    if (bytes >= kMinHugeBytes && InterleavePages(p, bytes))
+        s_InterleavedBytes += bytes;
+
+    // Fresh pages are zero, so writing one byte per 4 KB is enough to fault them
+    // in. The chunks go out like any ParallelFor job, so the faults are shared
+    // by the pool.
+    touchChunkBytes = RoundUp(std::max<size_t>(touchChunkBytes, 1), 4096);
+    size_t numChunks = (bytes + touchChunkBytes - 1) / touchChunkBytes;
+    ParallelFor(int(numChunks), 1, [&](int chunk, int begin, int end)
+    {
+        size_t first = size_t(begin) * touchChunkBytes;
+        size_t last = std::min(bytes, size_t(end) * touchChunkBytes);
+        for (size_t i = first; i < last; i += 4096)
+            p[i] = 0;
+    });
+    return p;
+}
+
+void FreeLarge(void* p, size_t bytes)
+{
+    if (p != NULL)
+        UnmapPages(p, bytes);
+}
+
+void PrintLargeMemoryStats()
+{
+    const double mb = 1.0 / (1024.0 * 1024.0);
+    printf("large allocations: %.1fMB huge pages, %.1fMB transparent huge pages requested, %.1fMB regular pages\n",
+        s_AllocatedBytes[kBackingHuge] * mb, s_AllocatedBytes[kBackingTransparent] * mb, s_AllocatedBytes[kBackingRegular] * mb);
+    if (s_InterleavedBytes > 0)
+        printf("large allocations: %.1fMB interleaved over %d NUMA nodes\n", s_InterleavedBytes * mb, NumaNodeCount());
+}
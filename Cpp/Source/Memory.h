@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+
+// Allocator for the wavefront arrays and the backbuffer. With DO_HUGE_PAGES the
+// memory comes from 2 MB pages when the OS hands them out (explicit huge pages,
+// then transparent huge pages, then regular pages), which keeps the TLB from
+// thrashing on multi-GB wavefronts. The pool hands kernel chunks out
+// dynamically to threads that aren't pinned, so no thread keeps working on the
+// same part of an array and first touch placement would put pages on whichever
+// node happened to fault them. With DO_NUMA_INTERLEAVE the allocations of at
+// least a huge page or so are instead interleaved page by page over the allowed
+// NUMA nodes (Linux only), which spreads the memory traffic evenly over the
+// nodes' controllers. The pages are then first touched from the thread pool in
+// chunks of touchChunkBytes, which only spreads the page faults.
+//
+// The memory is zero filled.
+void* AllocLarge(size_t bytes, size_t touchChunkBytes);
+void FreeLarge(void* p, size_t bytes);
+
+// bytes allocated so far, by how they are backed and whether they're interleaved
+void PrintLargeMemoryStats();
+
+template<typename T>
+T* AllocLargeArray(size_t count, int chunkItems)
+{
+    return (T*)AllocLarge(count * sizeof(T), size_t(chunkItems) * sizeof(T));
+}
+
+template<typename T>
+void FreeLargeArray(T* p, size_t count)
+{
+    FreeLarge(p, count * sizeof(T));
+}
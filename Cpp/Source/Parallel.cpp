@@ -0,0 +1,152 @@
+#include "Parallel.h"
+#include "Config.h"
+#include "PerfCounters.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ParallelJob
+{
+    ParallelChunkFunc func;
+    const void* ctx;
+    int count, chunkSize, numChunks;
+    int priority;
+    std::atomic<int> nextChunk;
+    std::atomic<int> doneChunks;
+    std::atomic<int> workers; // pool threads currently holding the job
+};
+
+struct ThreadPool
+{
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<ParallelJob*> jobs;
+    std::vector<std::thread> threads;
+    bool quit = false;
+
+    ThreadPool();
+    ~ThreadPool();
+};
+
+static void RunChunks(ParallelJob* job)
+{
+    for (int c = job->nextChunk++; c < job->numChunks; c = job->nextChunk++)
+    {
+        int begin = c * job->chunkSize;
+        int end = std::min(begin + job->chunkSize, job->count);
+        job->func(job->ctx, c, begin, end);
+        job->doneChunks++;
+    }
+}
+
+static void WorkerLoop(ThreadPool* pool)
+{
+#if DO_PERF_COUNTERS
+    OpenThreadPerfCounters();
+#endif // DO_PERF_COUNTERS
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    while (true)
+    {
+        pool->wake.wait(lock, [pool] { return pool->quit || !pool->jobs.empty(); });
+        if (pool->quit)
+            return;
+
+        // the oldest of the most urgent jobs
+        ParallelJob* job = pool->jobs.front();
+        for (size_t i = 1; i < pool->jobs.size(); i++)
+        {
+            if (pool->jobs[i]->priority > job->priority)
+                job = pool->jobs[i];
+        }
+        job->workers++;
+        lock.unlock();
+        RunChunks(job);
+        lock.lock();
+        // every chunk is handed out, nobody else needs to find this job
+        pool->jobs.erase(std::remove(pool->jobs.begin(), pool->jobs.end(), job), pool->jobs.end());
+        job->workers--;
+    }
+}
+
+ThreadPool::ThreadPool()
+{
+    int numThreads = std::max(1, int(std::thread::hardware_concurrency()));
+    for (int i = 0; i < numThreads - 1; i++)
+        threads.push_back(std::thread(WorkerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+}
+
+static thread_local int s_Priority = 0;
+
+static ThreadPool& GetPool()
+{
+    static ThreadPool s_Pool;
+    return s_Pool;
+}
+
+int ParallelThreadCount()
+{
+    return int(GetPool().threads.size()) + 1;
+}
+
+void SetParallelPriority(int priority)
+{
+    s_Priority = priority;
+}
+
+int ParallelChunkCount(int count, int chunkSize)
+{
+    return (count + chunkSize - 1) / chunkSize;
+}
+
+void ParallelForChunks(int count, int chunkSize, ParallelChunkFunc func, const void* ctx)
+{
+    ParallelJob job;
+    job.func = func;
+    job.ctx = ctx;
+    job.count = count;
+    job.chunkSize = chunkSize;
+    job.numChunks = ParallelChunkCount(count, chunkSize);
+    job.priority = s_Priority;
+    job.nextChunk = 0;
+    job.doneChunks = 0;
+    job.workers = 0;
+    if (job.numChunks == 0)
+        return;
+
+    ThreadPool& pool = GetPool();
+    if (job.numChunks == 1 || pool.threads.empty())
+    {
+        RunChunks(&job);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.jobs.push_back(&job);
+    }
+    pool.wake.notify_all();
+
+    RunChunks(&job);
+
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.jobs.erase(std::remove(pool.jobs.begin(), pool.jobs.end(), &job), pool.jobs.end());
+    }
+    // the job lives on this stack, wait until no pool thread can still touch it
+    while (job.doneChunks < job.numChunks || job.workers > 0)
+        std::this_thread::yield();
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// Small shared thread pool. ParallelFor splits [0, count) into chunks of
+// chunkSize items, so the chunk boundaries (and anything seeded per chunk) don't
+// depend on how many threads there are. The calling thread works on its own
+// job too, so ParallelFor may be called from several threads at once.
+
+typedef void (*ParallelChunkFunc)(const void* ctx, int chunkIdx, int begin, int end);
+
+void ParallelForChunks(int count, int chunkSize, ParallelChunkFunc func, const void* ctx);
+int ParallelThreadCount();
+
+// Priority of the ParallelFor calls made from the calling thread, 0 by default.
+// Idle pool threads help the highest priority job first, so urgent work that
+// runs next to a long one gets most of the pool.
+void SetParallelPriority(int priority);
+int ParallelChunkCount(int count, int chunkSize);
+
+template<typename F>
+void ParallelForThunk(const void* ctx, int chunkIdx, int begin, int end)
+{
+    (*(const F*)ctx)(chunkIdx, begin, end);
+}
+
+// f(chunkIdx, begin, end)
+template<typename F>
+void ParallelFor(int count, int chunkSize, const F& f)
+{
+    ParallelForChunks(count, chunkSize, ParallelForThunk<F>, &f);
+}
@@ -0,0 +1,137 @@
+#include "PathGuide.h"
+#include "SpatialHash.h"
+#include <algorithm>
+#include <stdio.h>
+
+// a cell is sampled from once this many path contributions went into it
+const int kGuideMinSplats = 64;
+// share of every cell's distribution spread uniformly, so that no direction's
+// density drops to zero because early frames never saw light from it
+const float kGuideUniformShare = 0.05f;
+const float kGuideBinSolidAngle = 4.0f * kPI / kGuideBins;
+
+struct PathGuide
+{
+    SpatialHash cells;
+    std::atomic<float>* radiance;   // kGuideBins per cell, summed over all frames
+    std::atomic<uint32_t>* splats;  // contributions per cell
+    float* cdf;                     // kGuideBins per cell, only valid for ready cells
+    uint8_t* ready;
+    int readyCells;
+};
+
+PathGuide* CreatePathGuide()
+{
+    PathGuide* guide = new PathGuide();
+    InitSpatialHash(guide->cells, kGuideCells);
+    guide->radiance = new std::atomic<float>[kGuideCells * kGuideBins];
+    guide->splats = new std::atomic<uint32_t>[kGuideCells];
+    guide->cdf = new float[kGuideCells * kGuideBins];
+    guide->ready = new uint8_t[kGuideCells];
+    for (int i = 0; i < kGuideCells; i++)
+    {
+        guide->splats[i].store(0, std::memory_order_relaxed);
+        guide->ready[i] = 0;
+    }
+    for (int i = 0; i < kGuideCells * kGuideBins; i++)
+        guide->radiance[i].store(0, std::memory_order_relaxed);
+    guide->readyCells = 0;
+    return guide;
+}
+
+void DestroyPathGuide(PathGuide* guide)
+{
+    FreeSpatialHash(guide->cells);
+    delete[] guide->radiance;
+    delete[] guide->splats;
+    delete[] guide->cdf;
+    delete[] guide->ready;
+    delete guide;
+}
+
+int GuideCell(PathGuide* guide, const f3& pos, const f3& normal, bool insert)
+{
+    return SpatialHashCell(guide->cells, pos, normal, kGuideCellSize, kGuideFineRadius, insert);
+}
+
+bool GuideReady(const PathGuide* guide, int cell)
+{
+    return cell >= 0 && guide->ready[cell] != 0;
+}
+
+int GuideBin(const f3& dir)
+{
+    int band = std::min(kGuideBands - 1, std::max(0, int((dir.y + 1.0f) * 0.5f * kGuideBands)));
+    float phi = atan2f(dir.z, dir.x) + kPI;
+    int sector = std::min(kGuideSectors - 1, std::max(0, int(phi * (0.5f / kPI) * kGuideSectors)));
+    return band * kGuideSectors + sector;
+}
+
+static float BinProb(const float* cdf, int bin)
+{
+    return bin > 0 ? cdf[bin] - cdf[bin - 1] : cdf[0];
+}
+
+f3 SampleGuide(const PathGuide* guide, int cell, uint32_t& state, float& pdf)
+{
+    const float* cdf = guide->cdf + cell * kGuideBins;
+    const float u = RandomFloat01(state);
+    const int bin = std::min(kGuideBins - 1, int(std::upper_bound(cdf, cdf + kGuideBins, u) - cdf));
+    pdf = BinProb(cdf, bin) / kGuideBinSolidAngle;
+
+    // uniform within the bin: bands are equal area, so uniform in cos(theta) and phi
+    const int band = bin / kGuideSectors, sector = bin % kGuideSectors;
+    const float y = -1.0f + (band + RandomFloat01(state)) * (2.0f / kGuideBands);
+    const float phi = (sector + RandomFloat01(state)) * (2.0f * kPI / kGuideSectors) - kPI;
+    const float r = sqrtf(std::max(0.0f, 1.0f - y * y));
+    return f3(r * cosf(phi), y, r * sinf(phi));
+}
+
+float GuidePdf(const PathGuide* guide, int cell, const f3& dir)
+{
+    return BinProb(guide->cdf + cell * kGuideBins, GuideBin(dir)) / kGuideBinSolidAngle;
+}
+
+void SplatGuide(PathGuide* guide, int cell, int bin, float radiance)
+{
+    std::atomic<float>& sum = guide->radiance[cell * kGuideBins + bin];
+    float old = sum.load(std::memory_order_relaxed);
+    while (!sum.compare_exchange_weak(old, old + radiance, std::memory_order_relaxed))
+        ;
+    guide->splats[cell].fetch_add(1, std::memory_order_relaxed);
+}
+
+void UpdatePathGuide(PathGuide* guide)
+{
+    int ready = 0;
+    for (int cell = 0; cell < kGuideCells; cell++)
+    {
+        guide->ready[cell] = 0;
+        if (guide->splats[cell].load(std::memory_order_relaxed) < kGuideMinSplats)
+            continue;
+        float total = 0;
+        for (int b = 0; b < kGuideBins; b++)
+            total += guide->radiance[cell * kGuideBins + b].load(std::memory_order_relaxed);
+        if (!(total > 0))
+            continue;
+
+        float* cdf = guide->cdf + cell * kGuideBins;
+        const float uniform = kGuideUniformShare / kGuideBins;
+        const float scale = (1.0f - kGuideUniformShare) / total;
+        float sum = 0;
+        for (int b = 0; b < kGuideBins; b++)
+        {
+            sum += uniform + guide->radiance[cell * kGuideBins + b].load(std::memory_order_relaxed) * scale;
+            cdf[b] = sum;
+        }
+        cdf[kGuideBins - 1] = 1.0f;
+        guide->ready[cell] = 1;
+        ready++;
+    }
+    guide->readyCells = ready;
+}
+
+void PrintPathGuideStats(const PathGuide* guide)
+{
+    printf("path guide: %d of %d cells used, %d ready to sample\n", guide->cells.used.load(), kGuideCells, guide->readyCells);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Maths.h"
+
+// Online path guiding for diffuse bounces. World space is cut into the cells of
+// a SpatialHash, kGuideCellSize wide within kGuideFineRadius of the origin. Each
+// cell learns a histogram of the radiance arriving from kGuideBins equal solid
+// angle direction bins, splatted lock free by the paths of the frame in
+// progress. Between frames the histograms are turned into sampling tables, so a
+// frame only samples from what earlier frames learned and the tables never
+// change under a running frame.
+const float kGuideCellSize = 0.125f;
+const float kGuideFineRadius = 2.0f;
+const int kGuideCells = 1 << 15;
+// 8 bands of equal height in cos(theta) times 8 sectors in phi
+const int kGuideBands = 8;
+const int kGuideSectors = 8;
+const int kGuideBins = kGuideBands * kGuideSectors;
+
+struct PathGuide;
+
+PathGuide* CreatePathGuide();
+void DestroyPathGuide(PathGuide* guide);
+
+// cell for a surface point, -1 if there is none; with insert a missing cell is
+// added unless the table is full
+int GuideCell(PathGuide* guide, const f3& pos, const f3& normal, bool insert);
+// whether a cell has learned enough to be sampled from
+bool GuideReady(const PathGuide* guide, int cell);
+
+int GuideBin(const f3& dir);
+// direction from a ready cell's distribution, and its solid angle density
+f3 SampleGuide(const PathGuide* guide, int cell, uint32_t& state, float& pdf);
+float GuidePdf(const PathGuide* guide, int cell, const f3& dir);
+
+// adds an estimate of the radiance arriving through a bin; thread safe
+void SplatGuide(PathGuide* guide, int cell, int bin, float radiance);
+
+// rebuilds the sampling tables from everything learned so far; call between
+// frames, with no frame in flight
+void UpdatePathGuide(PathGuide* guide);
+void PrintPathGuideStats(const PathGuide* guide);
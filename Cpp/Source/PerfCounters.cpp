@@ -0,0 +1,194 @@
+#include "PerfCounters.h"
+#include <mutex>
+#include <string.h>
+#include <vector>
+
+static const char* const s_EventNames[kPerfEventCount] = { "cycles", "instructions", "llc-misses", "branch-misses", "dtlb-misses", "node-misses" };
+
+const char* PerfEventName(int event)
+{
+    return s_EventNames[event];
+}
+
+#if defined(__linux__)
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// one thread's counters, -1 for the events it couldn't open. Grouped events
+// are read through the leader, in the order they joined the group.
+struct ThreadCounters
+{
+    int leader;
+    int fd[kPerfEventCount];
+    int groupSlot[kPerfEventCount]; // -1 when counted on its own
+};
+
+static std::mutex s_Mutex;
+static std::vector<ThreadCounters> s_Threads;
+static bool s_Available[kPerfEventCount];
+static thread_local bool s_ThreadOpened = false;
+
+static void EventAttr(int event, perf_event_attr& attr)
+{
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 0;
+    // user space only, which unprivileged processes may count at the default paranoia
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING | PERF_FORMAT_GROUP;
+    switch (event)
+    {
+    case kPerfCycles:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case kPerfInstructions:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case kPerfLlcMisses:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case kPerfBranchMisses:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    case kPerfDtlbMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case kPerfNodeMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    }
+}
+
+void OpenThreadPerfCounters()
+{
+    if (s_ThreadOpened)
+        return;
+    s_ThreadOpened = true;
+
+    // the first event that opens leads the group; one the CPU lacks, or that
+    // doesn't fit next to the others, falls back to counting alone
+    ThreadCounters tc;
+    tc.leader = -1;
+    int groupSize = 0;
+    bool any = false;
+    for (int e = 0; e < kPerfEventCount; e++)
+    {
+        perf_event_attr attr;
+        EventAttr(e, attr);
+        tc.fd[e] = int(syscall(__NR_perf_event_open, &attr, 0, -1, tc.leader, 0));
+        tc.groupSlot[e] = -1;
+        if (tc.fd[e] >= 0)
+        {
+            if (tc.leader < 0)
+                tc.leader = tc.fd[e];
+            tc.groupSlot[e] = groupSize++;
+        }
+        else if (tc.leader >= 0)
+            tc.fd[e] = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        any |= tc.fd[e] >= 0;
+    }
+    if (!any)
+        return;
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    for (int e = 0; e < kPerfEventCount; e++)
+        s_Available[e] |= tc.fd[e] >= 0;
+    s_Threads.push_back(tc);
+}
+
+bool PerfEventAvailable(int event)
+{
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    return s_Available[event];
+}
+
+// value, time enabled and time running of each event
+const int kRawPerEvent = 3;
+
+// Group reads come back as the number of events, the times, then the values;
+// reading a lone event returns the same layout for a group of one. Events that
+// failed to open or to read stay zero.
+static void ReadThread(const ThreadCounters& tc, uint64_t* raw)
+{
+    memset(raw, 0, kPerfEventCount * kRawPerEvent * sizeof(uint64_t));
+    uint64_t group[3 + kPerfEventCount];
+    const bool groupRead = tc.leader >= 0 && read(tc.leader, group, sizeof(group)) >= ssize_t(3 * sizeof(uint64_t));
+    for (int e = 0; e < kPerfEventCount; e++)
+    {
+        uint64_t* r = raw + e * kRawPerEvent;
+        if (tc.groupSlot[e] >= 0)
+        {
+            if (!groupRead || uint64_t(tc.groupSlot[e]) >= group[0])
+                continue;
+            r[0] = group[3 + tc.groupSlot[e]];
+            r[1] = group[1];
+            r[2] = group[2];
+        }
+        else if (tc.fd[e] >= 0)
+        {
+            uint64_t single[4];
+            if (read(tc.fd[e], single, sizeof(single)) != sizeof(single))
+                continue;
+            r[0] = single[3];
+            r[1] = single[1];
+            r[2] = single[2];
+        }
+    }
+}
+
+void ReadPerfCounters(PerfReading& reading)
+{
+    OpenThreadPerfCounters();
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    reading.raw.resize(s_Threads.size() * kPerfEventCount * kRawPerEvent);
+    for (size_t t = 0; t < s_Threads.size(); t++)
+        ReadThread(s_Threads[t], &reading.raw[t * kPerfEventCount * kRawPerEvent]);
+}
+
+void AddPerfCountsSince(const PerfReading& mark, const PerfReading& now, PerfCounts& counts)
+{
+    // threads that opened their counters after mark count from zero
+    for (size_t i = 0; i + kRawPerEvent <= now.raw.size(); i += kRawPerEvent)
+    {
+        const int e = int(i / kRawPerEvent % kPerfEventCount);
+        uint64_t before[kRawPerEvent] = {};
+        if (i < mark.raw.size())
+            memcpy(before, &mark.raw[i], sizeof(before));
+        const uint64_t* after = &now.raw[i];
+        if (after[0] < before[0] || after[2] <= before[2] || after[1] < before[1])
+            continue;
+        const uint64_t value = after[0] - before[0], enabled = after[1] - before[1], running = after[2] - before[2];
+        counts.value[e] += running < enabled ? uint64_t(double(value) * enabled / running) : value;
+    }
+}
+
+#else
+
+void OpenThreadPerfCounters()
+{
+}
+
+bool PerfEventAvailable(int event)
+{
+    return false;
+}
+
+void ReadPerfCounters(PerfReading& reading)
+{
+    reading.raw.clear();
+}
+
+void AddPerfCountsSince(const PerfReading& mark, const PerfReading& now, PerfCounts& counts)
+{
+}
+
+#endif
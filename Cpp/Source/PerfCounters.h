@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Hardware performance counters through Linux perf_event_open, to tell compute
+// bound stages from memory bound ones. Counters are per thread: every pool
+// thread opens its own when it starts, other threads on their first read, and
+// a read covers all of them. A thread's events are opened as one group, so the
+// kernel schedules them together and their ratios stay meaningful; an event that
+// can't join the group (no counter left for it) is counted on its own. Events
+// the kernel refuses (containers, VMs,
+// perf_event_paranoid, CPUs without the event) are left out and reported as
+// unavailable; elsewhere than Linux nothing is available.
+
+enum PerfEvent
+{
+    kPerfCycles,
+    kPerfInstructions,
+    kPerfLlcMisses,
+    kPerfBranchMisses,
+    kPerfDtlbMisses,
+    kPerfNodeMisses, // loads served by another NUMA node's memory
+    kPerfEventCount
+};
+
+struct PerfCounts
+{
+    uint64_t value[kPerfEventCount];
+};
+
+// opens the calling thread's counters unless it already has them
+void OpenThreadPerfCounters();
+// whether an event could be opened on any thread
+bool PerfEventAvailable(int event);
+const char* PerfEventName(int event);
+
+// raw counts of every thread's events with the time they were enabled and
+// running, in the order the threads opened them
+struct PerfReading
+{
+    std::vector<uint64_t> raw;
+};
+
+void ReadPerfCounters(PerfReading& reading);
+// Adds what every thread counted between two readings to counts. When the
+// kernel had to multiplex the counters, each thread's counts are scaled up by
+// how long they were enabled over how long they ran in between; the scaled
+// totals themselves aren't monotonic, so only raw counts are subtracted.
+void AddPerfCountsSince(const PerfReading& mark, const PerfReading& now, PerfCounts& counts);
@@ -0,0 +1,249 @@
+#include "Primitives.h"
+#include "Compact.h"
+#include <algorithm>
+#include <stdio.h>
+
+static void PushF3(std::vector<float>& x, std::vector<float>& y, std::vector<float>& z, const f3& v)
+{
+    x.push_back(v.x);
+    y.push_back(v.y);
+    z.push_back(v.z);
+}
+
+static f3 LoadF3(const std::vector<float>& x, const std::vector<float>& y, const std::vector<float>& z, int i)
+{
+    return f3(x[i], y[i], z[i]);
+}
+
+// two unit tangents completing n to an orthonormal basis
+static void TangentBasis(const f3& n, f3& t, f3& b)
+{
+    t = normalize(fabsf(n.x) > 0.9f ? cross(f3(0, 1, 0), n) : cross(f3(1, 0, 0), n));
+    b = cross(n, t);
+}
+
+// compact wavefront hits only have room for kPackedHitIdBits of id
+static bool PoolFull(int count, const char* kind)
+{
+#if DO_COMPACT_WAVEFRONT
+    if (count >= (1 << kPackedHitIdBits))
+    {
+        printf("can't add more than %d %s with DO_COMPACT_WAVEFRONT\n", 1 << kPackedHitIdBits, kind);
+        return true;
+    }
+#endif
+    return false;
+}
+
+int AddPlane(PrimitivePools& p, const f3& normal, float offset)
+{
+    if (PoolFull(PrimitiveCount(p, kPrimPlane), "planes"))
+        return -1;
+    PushF3(p.planes.nx, p.planes.ny, p.planes.nz, normalize(normal));
+    p.planes.d.push_back(offset);
+    return int(p.planes.d.size()) - 1;
+}
+
+int AddBox(PrimitivePools& p, const f3& bmin, const f3& bmax)
+{
+    if (PoolFull(PrimitiveCount(p, kPrimBox), "boxes"))
+        return -1;
+    PushF3(p.boxes.minX, p.boxes.minY, p.boxes.minZ, bmin);
+    PushF3(p.boxes.maxX, p.boxes.maxY, p.boxes.maxZ, bmax);
+    return int(p.boxes.minX.size()) - 1;
+}
+
+int AddDisk(PrimitivePools& p, const f3& center, const f3& normal, float radius)
+{
+    if (PoolFull(PrimitiveCount(p, kPrimDisk), "disks"))
+        return -1;
+    PushF3(p.disks.cx, p.disks.cy, p.disks.cz, center);
+    PushF3(p.disks.nx, p.disks.ny, p.disks.nz, normalize(normal));
+    p.disks.radius2.push_back(radius * radius);
+    return int(p.disks.radius2.size()) - 1;
+}
+
+int AddQuad(PrimitivePools& p, const f3& corner, const f3& edgeU, const f3& edgeV)
+{
+    if (PoolFull(PrimitiveCount(p, kPrimQuad), "quads"))
+        return -1;
+    QuadPool& q = p.quads;
+    const f3 n = cross(edgeU, edgeV);
+    PushF3(q.ox, q.oy, q.oz, corner);
+    PushF3(q.ux, q.uy, q.uz, edgeU);
+    PushF3(q.vx, q.vy, q.vz, edgeV);
+    PushF3(q.nx, q.ny, q.nz, normalize(n));
+    PushF3(q.wx, q.wy, q.wz, n * (1.0f / n.sqLength()));
+    return int(q.ox.size()) - 1;
+}
+
+int PrimitiveCount(const PrimitivePools& p, int type)
+{
+    switch (type)
+    {
+    case kPrimPlane: return int(p.planes.d.size());
+    case kPrimBox: return int(p.boxes.minX.size());
+    case kPrimDisk: return int(p.disks.radius2.size());
+    case kPrimQuad: return int(p.quads.ox.size());
+    default: return 0;
+    }
+}
+
+static void HitPlanes(const PlanePool& pool, const Ray& r, float tMin, float& closest, Hit& hit)
+{
+    const int count = int(pool.d.size());
+    for (int i = 0; i < count; i++)
+    {
+        float denom = pool.nx[i] * r.dir.x + pool.ny[i] * r.dir.y + pool.nz[i] * r.dir.z;
+        float dist = pool.d[i] - (pool.nx[i] * r.orig.x + pool.ny[i] * r.orig.y + pool.nz[i] * r.orig.z);
+        // a ray parallel to the plane gives an infinite or NaN t, which fails the range test
+        float t = dist / denom;
+        if (t > tMin && t < closest)
+        {
+            closest = t;
+            hit = Hit(t, i, kPrimPlane);
+        }
+    }
+}
+
+static void HitBoxes(const BoxPool& pool, const Ray& r, float tMin, float& closest, Hit& hit)
+{
+    const f3 invDir(1.0f / r.dir.x, 1.0f / r.dir.y, 1.0f / r.dir.z);
+    const int count = int(pool.minX.size());
+    for (int i = 0; i < count; i++)
+    {
+        float tx0 = (pool.minX[i] - r.orig.x) * invDir.x, tx1 = (pool.maxX[i] - r.orig.x) * invDir.x;
+        float ty0 = (pool.minY[i] - r.orig.y) * invDir.y, ty1 = (pool.maxY[i] - r.orig.y) * invDir.y;
+        float tz0 = (pool.minZ[i] - r.orig.z) * invDir.z, tz1 = (pool.maxZ[i] - r.orig.z) * invDir.z;
+        float tNear = fmaxf(fmaxf(fminf(tx0, tx1), fminf(ty0, ty1)), fminf(tz0, tz1));
+        float tFar = fminf(fminf(fmaxf(tx0, tx1), fmaxf(ty0, ty1)), fmaxf(tz0, tz1));
+        // from inside the box the far side is the hit
+        float t = tNear > tMin ? tNear : tFar;
+        if (tNear <= tFar && t > tMin && t < closest)
+        {
+            closest = t;
+            hit = Hit(t, i, kPrimBox);
+        }
+    }
+}
+
+static void HitDisks(const DiskPool& pool, const Ray& r, float tMin, float& closest, Hit& hit)
+{
+    const int count = int(pool.radius2.size());
+    for (int i = 0; i < count; i++)
+    {
+        float ox = pool.cx[i] - r.orig.x, oy = pool.cy[i] - r.orig.y, oz = pool.cz[i] - r.orig.z;
+        float denom = pool.nx[i] * r.dir.x + pool.ny[i] * r.dir.y + pool.nz[i] * r.dir.z;
+        float t = (pool.nx[i] * ox + pool.ny[i] * oy + pool.nz[i] * oz) / denom;
+        float px = r.dir.x * t - ox, py = r.dir.y * t - oy, pz = r.dir.z * t - oz;
+        if (t > tMin && t < closest && px * px + py * py + pz * pz <= pool.radius2[i])
+        {
+            closest = t;
+            hit = Hit(t, i, kPrimDisk);
+        }
+    }
+}
+
+static void HitQuads(const QuadPool& pool, const Ray& r, float tMin, float& closest, Hit& hit)
+{
+    const int count = int(pool.ox.size());
+    for (int i = 0; i < count; i++)
+    {
+        float ox = pool.ox[i] - r.orig.x, oy = pool.oy[i] - r.orig.y, oz = pool.oz[i] - r.orig.z;
+        float denom = pool.nx[i] * r.dir.x + pool.ny[i] * r.dir.y + pool.nz[i] * r.dir.z;
+        float t = (pool.nx[i] * ox + pool.ny[i] * oy + pool.nz[i] * oz) / denom;
+        // the hit relative to the corner, then its coordinates along both edges
+        f3 q(r.dir.x * t - ox, r.dir.y * t - oy, r.dir.z * t - oz);
+        f3 w(pool.wx[i], pool.wy[i], pool.wz[i]);
+        float a = dot(w, cross(q, f3(pool.vx[i], pool.vy[i], pool.vz[i])));
+        float b = dot(w, cross(f3(pool.ux[i], pool.uy[i], pool.uz[i]), q));
+        if (t > tMin && t < closest && a >= 0 && a <= 1 && b >= 0 && b <= 1)
+        {
+            closest = t;
+            hit = Hit(t, i, kPrimQuad);
+        }
+    }
+}
+
+void HitPrimitives(const PrimitivePools& p, const Ray& r, float tMin, float& closest, Hit& hit)
+{
+    HitPlanes(p.planes, r, tMin, closest, hit);
+    HitBoxes(p.boxes, r, tMin, closest, hit);
+    HitDisks(p.disks, r, tMin, closest, hit);
+    HitQuads(p.quads, r, tMin, closest, hit);
+}
+
+// the box face a point lies on: 0-2 for the min faces along x, y, z, 3-5 for max
+static int BoxFace(const BoxPool& pool, int i, const f3& pos)
+{
+    const float dist[6] =
+    {
+        fabsf(pos.x - pool.minX[i]), fabsf(pos.y - pool.minY[i]), fabsf(pos.z - pool.minZ[i]),
+        fabsf(pos.x - pool.maxX[i]), fabsf(pos.y - pool.maxY[i]), fabsf(pos.z - pool.maxZ[i]),
+    };
+    return int(std::min_element(dist, dist + 6) - dist);
+}
+
+f3 PrimitiveNormal(const PrimitivePools& p, int type, int id, const f3& pos)
+{
+    switch (type)
+    {
+    case kPrimPlane: return LoadF3(p.planes.nx, p.planes.ny, p.planes.nz, id);
+    case kPrimDisk: return LoadF3(p.disks.nx, p.disks.ny, p.disks.nz, id);
+    case kPrimQuad: return LoadF3(p.quads.nx, p.quads.ny, p.quads.nz, id);
+    case kPrimBox:
+    {
+        const int face = BoxFace(p.boxes, id, pos);
+        const float sign = face < 3 ? -1.0f : 1.0f;
+        return f3(face % 3 == 0 ? sign : 0, face % 3 == 1 ? sign : 0, face % 3 == 2 ? sign : 0);
+    }
+    default: return f3(0, 1, 0);
+    }
+}
+
+void PrimitiveUv(const PrimitivePools& p, int type, int id, const f3& pos, float& u, float& v, float& uvLength)
+{
+    u = v = 0;
+    uvLength = 1;
+    switch (type)
+    {
+    case kPrimPlane:
+    {
+        f3 t, b;
+        TangentBasis(LoadF3(p.planes.nx, p.planes.ny, p.planes.nz, id), t, b);
+        u = dot(pos, t);
+        v = dot(pos, b);
+        break;
+    }
+    case kPrimBox:
+    {
+        // the two axes along the face
+        const int axis = BoxFace(p.boxes, id, pos) % 3;
+        u = axis == 0 ? pos.z : pos.x;
+        v = axis == 1 ? pos.z : pos.y;
+        break;
+    }
+    case kPrimDisk:
+    {
+        f3 t, b;
+        TangentBasis(LoadF3(p.disks.nx, p.disks.ny, p.disks.nz, id), t, b);
+        const f3 d = pos - LoadF3(p.disks.cx, p.disks.cy, p.disks.cz, id);
+        const float diameter = 2.0f * sqrtf(p.disks.radius2[id]);
+        u = 0.5f + dot(d, t) / diameter;
+        v = 0.5f + dot(d, b) / diameter;
+        uvLength = diameter;
+        break;
+    }
+    case kPrimQuad:
+    {
+        const QuadPool& q = p.quads;
+        const f3 d = pos - LoadF3(q.ox, q.oy, q.oz, id);
+        const f3 w = LoadF3(q.wx, q.wy, q.wz, id);
+        const f3 eu = LoadF3(q.ux, q.uy, q.uz, id), ev = LoadF3(q.vx, q.vy, q.vz, id);
+        u = dot(w, cross(d, ev));
+        v = dot(w, cross(eu, d));
+        uvLength = sqrtf(eu.length() * ev.length());
+        break;
+    }
+    }
+}
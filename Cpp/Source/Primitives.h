@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Maths.h"
+#include <vector>
+
+// Analytic primitives besides spheres. Each kind lives in its own pool, a
+// structure of arrays, and is intersected by its own loop over that pool, so
+// the tests stay branch free and the loops vectorize. Ground planes and room
+// walls cost a dot product and a division instead of the quadratic of a huge
+// sphere, and stay exact however far away they are hit.
+//
+// Hits carry the pool in Hit::type and the index within it in Hit::id.
+
+// infinite plane dot(n, p) = d
+struct PlanePool
+{
+    std::vector<float> nx, ny, nz, d;
+};
+
+// axis aligned box
+struct BoxPool
+{
+    std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+};
+
+// disk of radius sqrtf(radius2) around c, facing n
+struct DiskPool
+{
+    std::vector<float> cx, cy, cz, nx, ny, nz, radius2;
+};
+
+// parallelogram corner + a * u + b * v with a, b in [0, 1]; n is the unit
+// normal and w = cross(u, v) / |cross(u, v)|^2, which turns a point in the
+// plane into (a, b)
+struct QuadPool
+{
+    std::vector<float> ox, oy, oz, ux, uy, uz, vx, vy, vz, nx, ny, nz, wx, wy, wz;
+};
+
+struct PrimitivePools
+{
+    PlanePool planes;
+    BoxPool boxes;
+    DiskPool disks;
+    QuadPool quads;
+};
+
+// each returns the new primitive's id within its pool, or -1 when the pool is
+// full: with DO_COMPACT_WAVEFRONT hits only hold ids below 1 << kPackedHitIdBits
+int AddPlane(PrimitivePools& p, const f3& normal, float offset);
+int AddBox(PrimitivePools& p, const f3& bmin, const f3& bmax);
+int AddDisk(PrimitivePools& p, const f3& center, const f3& normal, float radius);
+int AddQuad(PrimitivePools& p, const f3& corner, const f3& edgeU, const f3& edgeV);
+
+int PrimitiveCount(const PrimitivePools& p, int type);
+
+// Closest hit among all pools nearer than closest; shrinks closest and fills hit
+// when there is one. r.dir has to be unit length.
+void HitPrimitives(const PrimitivePools& p, const Ray& r, float tMin, float& closest, Hit& hit);
+
+// Unit normal at a point on a primitive: outward for boxes, the stored side for
+// the flat ones
+f3 PrimitiveNormal(const PrimitivePools& p, int type, int id, const f3& pos);
+
+// Texture coordinates at a point on a primitive, and the world space length one
+// uv unit spans there. Quads and disks span [0, 1], planes and box faces use
+// world units along two axes of the surface.
+void PrimitiveUv(const PrimitivePools& p, int type, int id, const f3& pos, float& u, float& v, float& uvLength);
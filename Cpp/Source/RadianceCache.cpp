@@ -0,0 +1,118 @@
+#include "RadianceCache.h"
+#include "SpatialHash.h"
+#include <algorithm>
+#include <stdio.h>
+
+// estimates a cell needs before lookups use it
+const float kCacheMinSamples = 16;
+// estimates the running average remembers, so that the cache keeps following
+// the paths that end in it while it converges
+const float kCacheMaxHistory = 1024;
+
+// estimates of the frame in progress: summed radiance and the number of paths
+struct CacheSplats
+{
+    std::atomic<float> r, g, b;
+    std::atomic<uint32_t> count;
+};
+
+struct RadianceCache
+{
+    SpatialHash cells;
+    CacheSplats* splats;
+    f3* radiance;
+    float* history; // estimates averaged into radiance
+    int readyCells;
+};
+
+RadianceCache* CreateRadianceCache()
+{
+    RadianceCache* cache = new RadianceCache();
+    InitSpatialHash(cache->cells, kCacheCells);
+    cache->splats = new CacheSplats[kCacheCells];
+    cache->radiance = new f3[kCacheCells];
+    cache->history = new float[kCacheCells];
+    for (int i = 0; i < kCacheCells; i++)
+    {
+        CacheSplats& s = cache->splats[i];
+        s.r.store(0, std::memory_order_relaxed);
+        s.g.store(0, std::memory_order_relaxed);
+        s.b.store(0, std::memory_order_relaxed);
+        s.count.store(0, std::memory_order_relaxed);
+        cache->radiance[i] = f3(0, 0, 0);
+        cache->history[i] = 0;
+    }
+    cache->readyCells = 0;
+    return cache;
+}
+
+void DestroyRadianceCache(RadianceCache* cache)
+{
+    FreeSpatialHash(cache->cells);
+    delete[] cache->splats;
+    delete[] cache->radiance;
+    delete[] cache->history;
+    delete cache;
+}
+
+int RadianceCacheCell(RadianceCache* cache, const f3& pos, const f3& normal, bool insert)
+{
+    return SpatialHashCell(cache->cells, pos, normal, kCacheCellSize, kCacheFineRadius, insert);
+}
+
+bool RadianceCacheLookup(const RadianceCache* cache, int cell, f3& radiance)
+{
+    if (cell < 0 || cache->history[cell] < kCacheMinSamples)
+        return false;
+    radiance = cache->radiance[cell];
+    return true;
+}
+
+static void AtomicAdd(std::atomic<float>& sum, float v)
+{
+    float old = sum.load(std::memory_order_relaxed);
+    while (!sum.compare_exchange_weak(old, old + v, std::memory_order_relaxed))
+        ;
+}
+
+void SplatRadianceCache(RadianceCache* cache, int cell, const f3& radiance)
+{
+    CacheSplats& s = cache->splats[cell];
+    AtomicAdd(s.r, radiance.x);
+    AtomicAdd(s.g, radiance.y);
+    AtomicAdd(s.b, radiance.z);
+}
+
+void AddRadianceCacheSample(RadianceCache* cache, int cell)
+{
+    cache->splats[cell].count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void UpdateRadianceCache(RadianceCache* cache)
+{
+    int ready = 0;
+    for (int cell = 0; cell < kCacheCells; cell++)
+    {
+        CacheSplats& s = cache->splats[cell];
+        const uint32_t count = s.count.load(std::memory_order_relaxed);
+        if (count > 0)
+        {
+            const f3 sum(s.r.load(std::memory_order_relaxed), s.g.load(std::memory_order_relaxed), s.b.load(std::memory_order_relaxed));
+            const float old = std::min(cache->history[cell], kCacheMaxHistory);
+            cache->radiance[cell] = (cache->radiance[cell] * old + sum) * (1.0f / (old + count));
+            cache->history[cell] = old + count;
+            s.r.store(0, std::memory_order_relaxed);
+            s.g.store(0, std::memory_order_relaxed);
+            s.b.store(0, std::memory_order_relaxed);
+            s.count.store(0, std::memory_order_relaxed);
+        }
+        if (cache->history[cell] >= kCacheMinSamples)
+            ready++;
+    }
+    cache->readyCells = ready;
+}
+
+void PrintRadianceCacheStats(const RadianceCache* cache)
+{
+    printf("radiance cache: %d of %d cells used, %d ready\n", cache->cells.used.load(), kCacheCells, cache->readyCells);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Maths.h"
+
+// World space cache of the radiance leaving diffuse surfaces, in the cells of a
+// SpatialHash keyed on position and normal. Paths add estimates lock free while
+// a frame renders; between frames they are folded into the cached values, which
+// stay fixed while a frame reads them. Diffuse paths that reach a ready cell deep
+// enough can end there instead of tracing their remaining bounces, at the cost
+// of the bias of averaging over a cell.
+const float kCacheCellSize = 0.0625f;
+const float kCacheFineRadius = 2.0f;
+const int kCacheCells = 1 << 16;
+
+struct RadianceCache;
+
+RadianceCache* CreateRadianceCache();
+void DestroyRadianceCache(RadianceCache* cache);
+
+// cell for a surface point, -1 if there is none; with insert a missing cell is
+// added unless the table is full
+int RadianceCacheCell(RadianceCache* cache, const f3& pos, const f3& normal, bool insert);
+// the cached outgoing radiance of a cell; false until enough estimates went in
+bool RadianceCacheLookup(const RadianceCache* cache, int cell, f3& radiance);
+
+// A path bouncing off a cell starts an estimate with AddRadianceCacheSample,
+// and every contribution the path receives after the bounce is splatted into
+// the cell, divided by the throughput that reached the bounce. Both thread safe.
+void AddRadianceCacheSample(RadianceCache* cache, int cell);
+void SplatRadianceCache(RadianceCache* cache, int cell, const f3& radiance);
+
+// folds the estimates of the last frame into the cached values; call between
+// frames, with no frame in flight
+void UpdateRadianceCache(RadianceCache* cache);
+void PrintRadianceCacheStats(const RadianceCache* cache);
@@ -0,0 +1,124 @@
+#include "RayQuery.h"
+#include "Bvh.h"
+
+struct RayQueryScene
+{
+    // set but not committed yet
+    std::vector<Sphere> pending;
+    // what queries see
+    std::vector<Sphere> spheres;
+    std::vector<Aabb> boxes;
+    Bvh bvh;
+};
+
+RayQueryScene* RayQueryCreateScene(void)
+{
+    return new RayQueryScene();
+}
+
+void RayQueryReleaseScene(RayQueryScene* scene)
+{
+    delete scene;
+}
+
+int RayQuerySetSpheres(RayQueryScene* scene, const float* centers, const float* radii, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (!(radii[i] > 0))
+            return 0;
+    }
+    scene->pending.resize(count > 0 ? count : 0);
+    for (int i = 0; i < count; i++)
+    {
+        Sphere& s = scene->pending[i];
+        s = Sphere(f3(centers[3 * i], centers[3 * i + 1], centers[3 * i + 2]), radii[i]);
+        s.UpdateDerivedData();
+    }
+    return 1;
+}
+
+void RayQueryCommit(RayQueryScene* scene)
+{
+    scene->spheres = scene->pending;
+    const int count = int(scene->spheres.size());
+    scene->boxes.resize(count);
+    for (int i = 0; i < count; i++)
+        scene->boxes[i] = SphereBounds(scene->spheres[i]);
+    scene->bvh.Build(scene->boxes.data(), count);
+}
+
+// the query as a unit length ray; t values scale by the direction's length
+static bool LoadQueryRay(const RayQueryRay& q, Ray& r, float& length)
+{
+    f3 dir(q.dir[0], q.dir[1], q.dir[2]);
+    length = dir.length();
+    if (!(length > 0))
+        return false;
+    r.orig = f3(q.org[0], q.org[1], q.org[2]);
+    r.dir = dir * (1.0f / length);
+    return true;
+}
+
+void RayQueryIntersect(const RayQueryScene* scene, const RayQueryRay* rays, int count, RayQueryHit* hits)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const RayQueryRay& q = rays[i];
+        RayQueryHit& hit = hits[i];
+        hit.t = q.tMax;
+        hit.primId = -1;
+        hit.normal[0] = hit.normal[1] = hit.normal[2] = 0;
+        Ray r;
+        float length;
+        if (!LoadQueryRay(q, r, length))
+            continue;
+
+        const float tMin = q.tMin * length;
+        float closest = q.tMax * length;
+        TraverseBvh(scene->bvh, r, tMin, closest, [&](int prim, float& closestT)
+        {
+            float hitT;
+            if (HitSphere(r, scene->spheres[prim], tMin, closestT, hitT))
+            {
+                closestT = hitT;
+                hit.primId = prim;
+            }
+        });
+        if (hit.primId < 0)
+            continue;
+        const Sphere& s = scene->spheres[hit.primId];
+        const f3 n = s.normalAt(r.pointAt(closest));
+        hit.t = closest / length;
+        hit.normal[0] = n.x;
+        hit.normal[1] = n.y;
+        hit.normal[2] = n.z;
+    }
+}
+
+void RayQueryOcclude(const RayQueryScene* scene, const RayQueryRay* rays, int count, unsigned char* occluded)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const RayQueryRay& q = rays[i];
+        occluded[i] = 0;
+        Ray r;
+        float length;
+        if (!LoadQueryRay(q, r, length))
+            continue;
+
+        const float tMin = q.tMin * length;
+        float closest = q.tMax * length;
+        TraverseBvh(scene->bvh, r, tMin, closest, [&](int prim, float& closestT)
+        {
+            float hitT;
+            if (HitSphere(r, scene->spheres[prim], tMin, closestT, hitT))
+            {
+                occluded[i] = 1;
+                // no box passes the slab test against an empty interval, so
+                // the traversal runs out without visiting more leaves
+                closestT = -1.0e30f;
+            }
+        });
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+// Embeddable ray queries against the renderer's sphere intersector, for tools
+// that need visibility or baking without the renderer. Plain C, so it links from
+// C and other languages; built as the RayQuery static library.
+//
+// A scene is created, filled from primitive arrays, committed (which builds its
+// BVH), queried, and released. There is no global state: queries run on the
+// calling thread and only read the committed scene, so any number of threads
+// may query the same scene at once. Setting primitives and committing must not
+// overlap with queries on that scene.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct RayQueryScene RayQueryScene;
+
+// Directions don't need to be unit length; distances are in units of the
+// direction, so with dir = target - org the target is at t = 1.
+typedef struct RayQueryRay
+{
+    float org[3];
+    float tMin;
+    float dir[3];
+    float tMax;
+} RayQueryRay;
+
+typedef struct RayQueryHit
+{
+    float t;         // tMax when nothing was hit
+    int primId;      // index into the committed primitives, -1 for a miss
+    float normal[3]; // unit geometric normal, facing out of the primitive
+} RayQueryHit;
+
+RayQueryScene* RayQueryCreateScene(void);
+void RayQueryReleaseScene(RayQueryScene* scene);
+
+// Replaces the scene's spheres with count spheres, centers as x,y,z triples.
+// The arrays are copied. Returns 0 and leaves the scene as it was if a radius
+// isn't positive.
+int RayQuerySetSpheres(RayQueryScene* scene, const float* centers, const float* radii, int count);
+
+// Builds the acceleration structure for what was set; queries see the scene as
+// of the last commit, and nothing before the first one.
+void RayQueryCommit(RayQueryScene* scene);
+
+// closest hit of every ray
+void RayQueryIntersect(const RayQueryScene* scene, const RayQueryRay* rays, int count, RayQueryHit* hits);
+
+// occluded[i] = 1 if anything lies between tMin and tMax along ray i, else 0;
+// stops at the first hit found, so it's cheaper than RayQueryIntersect
+void RayQueryOcclude(const RayQueryScene* scene, const RayQueryRay* rays, int count, unsigned char* occluded);
+
+#ifdef __cplusplus
+}
+#endif
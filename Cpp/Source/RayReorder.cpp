@@ -0,0 +1,143 @@
+#include "RayReorder.h"
+#include "Memory.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <vector>
+
+const int kReorderChunk = 16 * 1024;
+
+void AllocReorderBuffers(ReorderBuffers& buffers, int maxRays)
+{
+    buffers.maxRays = maxRays;
+    buffers.keys = AllocLargeArray<uint32_t>(maxRays, kReorderChunk);
+    buffers.keysTmp = AllocLargeArray<uint32_t>(maxRays, kReorderChunk);
+    buffers.perm = AllocLargeArray<int>(maxRays, kReorderChunk);
+    buffers.permTmp = AllocLargeArray<int>(maxRays, kReorderChunk);
+}
+
+void FreeReorderBuffers(ReorderBuffers& buffers)
+{
+    FreeLargeArray(buffers.keys, buffers.maxRays);
+    FreeLargeArray(buffers.keysTmp, buffers.maxRays);
+    FreeLargeArray(buffers.perm, buffers.maxRays);
+    FreeLargeArray(buffers.permTmp, buffers.maxRays);
+}
+
+// spreads the low 8 bits of v so there are two zero bits between each of them
+static uint32_t Part1By2(uint32_t v)
+{
+    v &= 0xFF;
+    v = (v | (v << 8)) & 0x0000F00F;
+    v = (v | (v << 4)) & 0x000C30C3;
+    v = (v | (v << 2)) & 0x00249249;
+    return v;
+}
+
+static uint32_t Quantize(float v, float lo, float scale, uint32_t maxValue)
+{
+    float q = (v - lo) * scale;
+    return uint32_t(std::min(std::max(q, 0.0f), float(maxValue)));
+}
+
+static void RadixSortByKey(uint32_t*& keys, int*& values, uint32_t*& keysTmp, int*& valuesTmp, int count)
+{
+    const int numChunks = ParallelChunkCount(count, kReorderChunk);
+    std::vector<int> offsets(numChunks * 256);
+
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        ParallelFor(count, kReorderChunk, [&](int chunk, int begin, int end)
+        {
+            int* hist = &offsets[chunk * 256];
+            std::fill(hist, hist + 256, 0);
+            for (int i = begin; i < end; i++)
+                hist[(keys[i] >> shift) & 0xFF]++;
+        });
+
+        // digit-major prefix sum, chunks in order keep the sort stable
+        int running = 0;
+        for (int d = 0; d < 256; d++)
+        {
+            for (int c = 0; c < numChunks; c++)
+            {
+                int n = offsets[c * 256 + d];
+                offsets[c * 256 + d] = running;
+                running += n;
+            }
+        }
+
+        ParallelFor(count, kReorderChunk, [&](int chunk, int begin, int end)
+        {
+            int* dst = &offsets[chunk * 256];
+            for (int i = begin; i < end; i++)
+            {
+                int o = dst[(keys[i] >> shift) & 0xFF]++;
+                keysTmp[o] = keys[i];
+                valuesTmp[o] = values[i];
+            }
+        });
+
+        std::swap(keys, keysTmp);
+        std::swap(values, valuesTmp);
+    }
+}
+
+void ReorderRays(const WaveRay* rays, const int* sIndices, int count,
+    WaveRay* raysOut, int* sIndicesOut, const ReorderBuffers& buffers)
+{
+    const int numChunks = ParallelChunkCount(count, kReorderChunk);
+
+    // bounds of all ray origins
+    std::vector<f3> chunkMin(numChunks), chunkMax(numChunks);
+    ParallelFor(count, kReorderChunk, [&](int chunk, int begin, int end)
+    {
+        f3 lo(1.0e30f, 1.0e30f, 1.0e30f), hi(-1.0e30f, -1.0e30f, -1.0e30f);
+        for (int i = begin; i < end; i++)
+        {
+            const f3& o = rays[i].orig;
+            lo = f3(std::min(lo.x, o.x), std::min(lo.y, o.y), std::min(lo.z, o.z));
+            hi = f3(std::max(hi.x, o.x), std::max(hi.y, o.y), std::max(hi.z, o.z));
+        }
+        chunkMin[chunk] = lo;
+        chunkMax[chunk] = hi;
+    });
+    f3 lo = chunkMin[0], hi = chunkMax[0];
+    for (int c = 1; c < numChunks; c++)
+    {
+        lo = f3(std::min(lo.x, chunkMin[c].x), std::min(lo.y, chunkMin[c].y), std::min(lo.z, chunkMin[c].z));
+        hi = f3(std::max(hi.x, chunkMax[c].x), std::max(hi.y, chunkMax[c].y), std::max(hi.z, chunkMax[c].z));
+    }
+    f3 ext = hi - lo;
+    f3 scale(ext.x > 0 ? 256.0f / ext.x : 0, ext.y > 0 ? 256.0f / ext.y : 0, ext.z > 0 ? 256.0f / ext.z : 0);
+
+    uint32_t* keys = buffers.keys;
+    int* perm = buffers.perm;
+    ParallelFor(count, kReorderChunk, [&](int chunk, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            const Ray r = LoadRay(rays[i]);
+            uint32_t morton = (Part1By2(Quantize(r.orig.x, lo.x, scale.x, 255)) << 2) |
+                (Part1By2(Quantize(r.orig.y, lo.y, scale.y, 255)) << 1) |
+                Part1By2(Quantize(r.orig.z, lo.z, scale.z, 255));
+            uint32_t oct = OctEncode(r.dir);
+            uint32_t du = uint32_t(int32_t(int16_t(oct >> 16)) + 32768) >> 12;
+            uint32_t dv = uint32_t(int32_t(int16_t(oct & 0xFFFF)) + 32768) >> 12;
+            keys[i] = (morton << 8) | (du << 4) | dv;
+            perm[i] = i;
+        }
+    });
+
+    uint32_t* keysTmp = buffers.keysTmp;
+    int* permTmp = buffers.permTmp;
+    RadixSortByKey(keys, perm, keysTmp, permTmp, count);
+
+    ParallelFor(count, kReorderChunk, [&](int chunk, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            raysOut[i] = rays[perm[i]];
+            sIndicesOut[i] = sIndices[perm[i]];
+        }
+    });
+}
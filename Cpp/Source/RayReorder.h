@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Compact.h"
+
+// Scratch memory for ReorderRays, sized for the full wavefront
+struct ReorderBuffers
+{
+    int maxRays;
+    uint32_t* keys;
+    uint32_t* keysTmp;
+    int* perm;
+    int* permTmp;
+};
+
+void AllocReorderBuffers(ReorderBuffers& buffers, int maxRays);
+void FreeReorderBuffers(ReorderBuffers& buffers);
+
+// Sorts the rays by a 32 bit key (24 bit Morton code of the origin inside the
+// bounds of all origins, then 8 bits of octahedral direction) with a stable
+// parallel radix sort, and gathers rays and their sample indices into the output
+// arrays in sorted order.
+void ReorderRays(const WaveRay* rays, const int* sIndices, int count,
+    WaveRay* raysOut, int* sIndicesOut, const ReorderBuffers& buffers);
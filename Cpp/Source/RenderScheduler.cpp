@@ -0,0 +1,177 @@
+#include "RenderScheduler.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+struct ScheduledJob
+{
+    RenderScheduler* sched;
+    int ticket;
+    RenderContext* ctx;
+    RenderJob job;
+    // the caller's progress callback; job.user points back to this job
+    bool (*progress)(void* user, int framesDone, int frames);
+    void* user;
+    float* backbuffer;
+    int priority;
+    bool running; // holds its context, possibly paused at a bounce boundary
+    bool done;
+    int rayCount;
+    std::thread thread;
+};
+
+struct RenderScheduler
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<ScheduledJob*> jobs; // submitted and not waited for yet
+    int nextTicket;
+    int jobsRun, pauses;
+};
+
+// whether a job may take its context: it's free, and no job waiting for it is
+// more urgent or was submitted earlier at the same priority
+static bool CanStart(const RenderScheduler& s, const ScheduledJob& sj)
+{
+    for (size_t i = 0; i < s.jobs.size(); i++)
+    {
+        const ScheduledJob& other = *s.jobs[i];
+        if (&other == &sj || other.ctx != sj.ctx || other.done)
+            continue;
+        if (other.running)
+            return false;
+        if (other.priority > sj.priority || (other.priority == sj.priority && other.ticket < sj.ticket))
+            return false;
+    }
+    return true;
+}
+
+// whether a running job has to make way; the most urgent running job never
+// does, so some job always makes progress
+static bool Outranked(const RenderScheduler& s, const ScheduledJob& sj)
+{
+    for (size_t i = 0; i < s.jobs.size(); i++)
+    {
+        const ScheduledJob& other = *s.jobs[i];
+        if (other.running && other.priority > sj.priority)
+            return true;
+    }
+    return false;
+}
+
+static void PauseIfOutranked(void* user)
+{
+    ScheduledJob* sj = (ScheduledJob*)user;
+    RenderScheduler* s = sj->sched;
+    std::unique_lock<std::mutex> lock(s->mutex);
+    if (!Outranked(*s, *sj))
+        return;
+    s->pauses++;
+    s->changed.wait(lock, [s, sj] { return !Outranked(*s, *sj); });
+}
+
+static bool ForwardProgress(void* user, int framesDone, int frames)
+{
+    ScheduledJob* sj = (ScheduledJob*)user;
+    if (sj->progress != NULL && !sj->progress(sj->user, framesDone, frames))
+        return false;
+    // frame boundaries are bounce boundaries too
+    PauseIfOutranked(sj);
+    return true;
+}
+
+static void RunScheduledJob(ScheduledJob* sj)
+{
+    RenderScheduler* s = sj->sched;
+    {
+        std::unique_lock<std::mutex> lock(s->mutex);
+        s->changed.wait(lock, [s, sj] { return CanStart(*s, *sj); });
+        sj->running = true;
+    }
+    // less urgent jobs only notice at their next bounce boundary; until then the
+    // pool already prefers this job's chunks
+    SetParallelPriority(sj->priority);
+    int rayCount = RenderContextJob(sj->ctx, sj->job, sj->backbuffer);
+    {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        sj->running = false;
+        sj->done = true;
+        sj->rayCount = rayCount;
+        s->jobsRun++;
+    }
+    s->changed.notify_all();
+}
+
+RenderScheduler* CreateRenderScheduler()
+{
+    RenderScheduler* sched = new RenderScheduler();
+    sched->nextTicket = 1;
+    sched->jobsRun = sched->pauses = 0;
+    return sched;
+}
+
+void DestroyRenderScheduler(RenderScheduler* sched)
+{
+    for (size_t i = 0; i < sched->jobs.size(); i++)
+    {
+        sched->jobs[i]->thread.join();
+        delete sched->jobs[i];
+    }
+    delete sched;
+}
+
+int SubmitRenderJob(RenderScheduler* sched, RenderContext* ctx, const RenderJob& job, float* backbuffer, int priority)
+{
+    ScheduledJob* sj = new ScheduledJob();
+    sj->sched = sched;
+    sj->ctx = ctx;
+    sj->job = job;
+    sj->job.progress = ForwardProgress;
+    sj->job.bounceDone = PauseIfOutranked;
+    sj->job.user = sj;
+    sj->progress = job.progress;
+    sj->user = job.user;
+    sj->backbuffer = backbuffer;
+    sj->priority = priority;
+    sj->running = sj->done = false;
+    sj->rayCount = 0;
+    {
+        std::lock_guard<std::mutex> lock(sched->mutex);
+        sj->ticket = sched->nextTicket++;
+        sched->jobs.push_back(sj);
+    }
+    sj->thread = std::thread(RunScheduledJob, sj);
+    return sj->ticket;
+}
+
+int WaitRenderJob(RenderScheduler* sched, int ticket)
+{
+    ScheduledJob* sj = NULL;
+    {
+        std::lock_guard<std::mutex> lock(sched->mutex);
+        for (size_t i = 0; i < sched->jobs.size(); i++)
+        {
+            if (sched->jobs[i]->ticket == ticket)
+                sj = sched->jobs[i];
+        }
+    }
+    if (sj == NULL)
+        return 0;
+    sj->thread.join();
+    {
+        std::lock_guard<std::mutex> lock(sched->mutex);
+        sched->jobs.erase(std::find(sched->jobs.begin(), sched->jobs.end(), sj));
+    }
+    int rayCount = sj->rayCount;
+    delete sj;
+    return rayCount;
+}
+
+void PrintRenderSchedulerStats(const RenderScheduler* sched)
+{
+    printf("render scheduler: %d jobs run, paused %d times for more urgent jobs\n", sched->jobsRun, sched->pauses);
+}
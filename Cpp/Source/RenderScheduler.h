@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Test.h"
+
+// Runs render jobs on several RenderContexts at once, all sharing the one
+// thread pool. Every job gets a priority; when a job starts, running jobs of
+// lower priority stop at their next bounce boundary and wait until no more
+// urgent job is running, so an interactive preview can jump ahead of a long
+// final render in the same process. A paused job keeps its wavefront and
+// continues where it stopped, its image is the same as if it had run alone.
+//
+// Jobs for the same context run one after another, the most urgent first. A job
+// waiting for a context held by a paused job also waits for whatever paused it.
+
+struct RenderScheduler;
+
+RenderScheduler* CreateRenderScheduler();
+// waits for the jobs that are still running
+void DestroyRenderScheduler(RenderScheduler* sched);
+
+// Starts a job on its own thread and returns its ticket right away; higher
+// priority is more urgent. job.progress is still called after every frame and
+// may cancel the job; job.bounceDone is taken over by the scheduler.
+int SubmitRenderJob(RenderScheduler* sched, RenderContext* ctx, const RenderJob& job, float* backbuffer, int priority);
+
+// blocks until the job is done and returns the number of rays it traced; every
+// ticket has to be waited for once
+int WaitRenderJob(RenderScheduler* sched, int ticket);
+
+// jobs run and times a job was paused for a more urgent one
+void PrintRenderSchedulerStats(const RenderScheduler* sched);
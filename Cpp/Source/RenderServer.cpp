@@ -0,0 +1,243 @@
+#include "RenderServer.h"
+#include "Memory.h"
+#include "Timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+
+int RunRenderServer(const char* socketPath, int screenWidth, int screenHeight, const RenderOptions& options, WriteImageFunc writeImage)
+{
+    printf("the render server needs Unix sockets, it isn't available on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+struct ServerClient
+{
+    int fd;
+    bool connected;
+};
+
+// sends a whole reply line; false once the client is gone
+static bool SendLine(ServerClient& client, const char* line)
+{
+    size_t len = strlen(line);
+    while (client.connected && len > 0)
+    {
+        ssize_t n = send(client.fd, line, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            client.connected = false;
+        else
+        {
+            line += n;
+            len -= size_t(n);
+        }
+    }
+    return client.connected;
+}
+
+static bool SendJobProgress(void* user, int framesDone, int frames)
+{
+    char line[64];
+    snprintf(line, sizeof(line), "progress %d %d\n", framesDone, frames);
+    return SendLine(*(ServerClient*)user, line);
+}
+
+static bool ParseVector(const char* s, float v[3])
+{
+    return sscanf(s, "%f,%f,%f", &v[0], &v[1], &v[2]) == 3;
+}
+
+// fills job and outPath from a render command; false with the reason in error
+static bool ParseRenderCommand(char* args, RenderJob& job, std::string& outPath, std::string& error)
+{
+    job.view = DefaultCameraView();
+    job.frames = 1;
+    job.firstFrame = 0;
+    outPath.clear();
+    for (char* tok = strtok(args, " \t"); tok != NULL; tok = strtok(NULL, " \t"))
+    {
+        const char* eq = strchr(tok, '=');
+        if (eq == NULL)
+        {
+            error = std::string("expected key=value, got ") + tok;
+            return false;
+        }
+        std::string key(tok, eq - tok);
+        const char* value = eq + 1;
+        bool ok = true;
+        if (key == "out")
+            outPath = value;
+        else if (key == "frames")
+            ok = (job.frames = atoi(value)) > 0;
+        else if (key == "from")
+            ok = ParseVector(value, job.view.lookFrom);
+        else if (key == "at")
+            ok = ParseVector(value, job.view.lookAt);
+        else if (key == "fov")
+            ok = (job.view.vfov = float(atof(value))) > 0;
+        else if (key == "aperture")
+            job.view.aperture = float(atof(value));
+        else if (key == "focus")
+            ok = (job.view.focusDist = float(atof(value))) > 0;
+        else
+        {
+            error = "unknown key " + key;
+            return false;
+        }
+        if (!ok)
+        {
+            error = "bad value for " + key;
+            return false;
+        }
+    }
+    if (outPath.empty())
+    {
+        error = "missing out=<path>";
+        return false;
+    }
+    return true;
+}
+
+int RunRenderServer(const char* socketPath, int screenWidth, int screenHeight, const RenderOptions& options, WriteImageFunc writeImage)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path))
+    {
+        printf("socket path %s is too long\n", socketPath);
+        return 1;
+    }
+    strcpy(addr.sun_path, socketPath);
+    // a socket left behind by an earlier server is replaced, anything else is
+    // most likely a mistyped path and stays untouched
+    struct stat st;
+    if (lstat(socketPath, &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+        {
+            printf("can't listen on %s: path exists and isn't a socket\n", socketPath);
+            return 1;
+        }
+        unlink(socketPath);
+    }
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0 || bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 4) != 0 || lstat(socketPath, &st) != 0)
+    {
+        printf("can't listen on %s: %s\n", socketPath, strerror(errno));
+        if (listenFd >= 0)
+            close(listenFd);
+        return 1;
+    }
+    // what bind created, so shutdown only removes our own socket
+    const dev_t socketDev = st.st_dev;
+    const ino_t socketIno = st.st_ino;
+
+    const double setupStart = NowSeconds();
+    RenderContext* ctx = CreateRenderContext(screenWidth, screenHeight, options);
+    const size_t backbufferFloats = size_t(screenWidth) * screenHeight * kBackbufferChannels;
+    float* backbuffer = AllocLargeArray<float>(backbufferFloats, screenWidth * kBackbufferChannels);
+    printf("serving %dx%d renders on %s, setup took %.2fs\n", screenWidth, screenHeight, socketPath, NowSeconds() - setupStart);
+    fflush(stdout);
+
+    bool quit = false;
+    while (!quit)
+    {
+        ServerClient client = { accept(listenFd, NULL, NULL), true };
+        if (client.fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            printf("accept failed: %s\n", strerror(errno));
+            break;
+        }
+
+        std::string pending;
+        char buf[1024];
+        while (client.connected && !quit)
+        {
+            size_t eol = pending.find('\n');
+            if (eol == std::string::npos)
+            {
+                ssize_t n = recv(client.fd, buf, sizeof(buf), 0);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    break;
+                pending.append(buf, size_t(n));
+                continue;
+            }
+            std::string line = pending.substr(0, eol);
+            pending.erase(0, eol + 1);
+            if (!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
+
+            char reply[1024];
+            if (line == "quit")
+            {
+                SendLine(client, "bye\n");
+                quit = true;
+            }
+            else if (line.compare(0, 6, "render") == 0 && (line.size() == 6 || line[6] == ' '))
+            {
+                RenderJob job;
+                std::string outPath, error;
+                std::vector<char> args(line.begin() + 6, line.end());
+                args.push_back(0);
+                if (!ParseRenderCommand(args.data(), job, outPath, error))
+                {
+                    snprintf(reply, sizeof(reply), "error %s\n", error.c_str());
+                    SendLine(client, reply);
+                    continue;
+                }
+                job.progress = SendJobProgress;
+                job.bounceDone = NULL;
+                job.user = &client;
+                const double t0 = NowSeconds();
+                int rayCount = RenderContextJob(ctx, job, backbuffer);
+                const double seconds = NowSeconds() - t0;
+                if (!client.connected)
+                    printf("client left during the job for %s\n", outPath.c_str());
+                else if (!writeImage(outPath.c_str(), backbuffer, screenWidth, screenHeight))
+                    snprintf(reply, sizeof(reply), "error can't write %s\n", outPath.c_str());
+                else
+                    snprintf(reply, sizeof(reply), "done %s %.3f %.2f\n", outPath.c_str(), seconds, rayCount / seconds * 1.0e-6);
+                if (client.connected)
+                {
+                    printf("%s", reply);
+                    fflush(stdout);
+                    SendLine(client, reply);
+                }
+            }
+            else if (!line.empty())
+            {
+                snprintf(reply, sizeof(reply), "error unknown command %s\n", line.c_str());
+                SendLine(client, reply);
+            }
+        }
+        close(client.fd);
+    }
+
+    close(listenFd);
+    if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode) && st.st_dev == socketDev && st.st_ino == socketIno)
+        unlink(socketPath);
+    FreeLargeArray(backbuffer, backbufferFloats);
+    DestroyRenderContext(ctx);
+    return 0;
+}
+
+#endif // _WIN32
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Test.h"
+
+// Daemon mode: one RenderContext stays resident and render jobs arrive over a
+// local Unix socket, one client at a time. The protocol is line based text.
+//
+//   render out=<path> [frames=<n>] [from=x,y,z] [at=x,y,z] [fov=deg]
+//          [aperture=a] [focus=d]
+//       renders the scene from the given view, DefaultCameraView for anything
+//       left out, and writes the image to path. The server answers with
+//       "progress <frame> <frames>" after every frame, then
+//       "done <path> <seconds> <Mrays/s>" or "error <reason>".
+//   quit
+//       answers "bye" and shuts the server down.
+//
+// A client that disconnects mid job cancels it after the current frame.
+
+// writes a width x height backbuffer with kBackbufferChannels floats per pixel
+typedef bool (*WriteImageFunc)(const char* path, const float* backbuffer, int width, int height);
+
+// Serves until a quit command arrives; returns the process exit code. Not
+// available on Windows.
+int RunRenderServer(const char* socketPath, int screenWidth, int screenHeight, const RenderOptions& options, WriteImageFunc writeImage);
@@ -0,0 +1,77 @@
+#include "Renderer.h"
+#include "Memory.h"
+#include <string.h>
+
+Renderer::Renderer() : m_Ctx(NULL), m_Backbuffer(NULL), m_BackbufferFloats(0), m_Width(0), m_Height(0), m_View(DefaultCameraView()), m_FramesDone(0)
+{
+}
+
+Renderer::~Renderer()
+{
+    Shutdown();
+}
+
+void Renderer::Init(int width, int height, const RenderOptions& settings)
+{
+    Shutdown();
+    m_Ctx = CreateRenderContext(width, height, settings);
+    m_Width = width;
+    m_Height = height;
+    m_BackbufferFloats = size_t(width) * height * kBackbufferChannels;
+    m_Backbuffer = AllocLargeArray<float>(m_BackbufferFloats, width * kBackbufferChannels);
+    m_View = DefaultCameraView();
+    m_FramesDone = 0;
+}
+
+void Renderer::Shutdown()
+{
+    if (m_Ctx == NULL)
+        return;
+    DestroyRenderContext(m_Ctx);
+    FreeLargeArray(m_Backbuffer, m_BackbufferFloats);
+    m_Ctx = NULL;
+    m_Backbuffer = NULL;
+    m_BackbufferFloats = 0;
+}
+
+int Renderer::RenderFrames(int n)
+{
+    RenderJob job;
+    job.view = m_View;
+    job.frames = n;
+    job.firstFrame = m_FramesDone;
+    job.progress = NULL;
+    job.bounceDone = NULL;
+    job.user = NULL;
+    int rayCount = RenderContextJob(m_Ctx, job, m_Backbuffer);
+    m_FramesDone += n;
+    return rayCount;
+}
+
+void Renderer::UpdateCamera(const CameraView& view)
+{
+    m_View = view;
+    m_FramesDone = 0;
+}
+
+void Renderer::Resize(int width, int height)
+{
+    if (width == m_Width && height == m_Height)
+        return;
+    ResizeRenderContext(m_Ctx, width, height);
+    const size_t floats = size_t(width) * height * kBackbufferChannels;
+    if (floats > m_BackbufferFloats)
+    {
+        FreeLargeArray(m_Backbuffer, m_BackbufferFloats);
+        m_Backbuffer = AllocLargeArray<float>(floats, width * kBackbufferChannels);
+        m_BackbufferFloats = floats;
+    }
+    m_Width = width;
+    m_Height = height;
+    m_FramesDone = 0;
+}
+
+void Renderer::Snapshot(float* dst) const
+{
+    memcpy(dst, m_Backbuffer, size_t(m_Width) * m_Height * kBackbufferChannels * sizeof(float));
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Test.h"
+
+// Progressive rendering driven by the caller, a few frames at a time. Init pays
+// for everything once: the scene copy, lights and textures, the intersection
+// backend with its acceleration structure, the wavefront and the backbuffer.
+// RenderFrames then keeps adding frames to the same image for as long as the
+// caller likes. Moving the camera or resizing starts the image over but keeps
+// all of that allocated, the backend included; only a larger size grows the
+// wavefront arrays and the backbuffer.
+//
+//   Renderer r;
+//   r.Init(1280, 720, options);
+//   while (...) {
+//       r.RenderFrames(4);
+//       r.Snapshot(pixels);
+//   }
+class Renderer
+{
+public:
+    Renderer();
+    ~Renderer();
+
+    // The scene is the built-in one, so the options are all it needs. Starts
+    // from DefaultCameraView; calling Init again starts from scratch.
+    void Init(int width, int height, const RenderOptions& settings);
+    void Shutdown();
+
+    // adds n frames of DO_SAMPLES_PER_PIXEL samples to the image; returns the
+    // number of rays traced
+    int RenderFrames(int n);
+    void UpdateCamera(const CameraView& view);
+    void Resize(int width, int height);
+    // copies the image so far, Width() * Height() * kBackbufferChannels floats,
+    // bottom row first
+    void Snapshot(float* dst) const;
+
+    int Width() const { return m_Width; }
+    int Height() const { return m_Height; }
+    int FramesDone() const { return m_FramesDone; }
+
+private:
+    Renderer(const Renderer&);
+    Renderer& operator=(const Renderer&);
+
+    RenderContext* m_Ctx;
+    float* m_Backbuffer;
+    size_t m_BackbufferFloats; // allocated, at least m_Width * m_Height * kBackbufferChannels
+    int m_Width, m_Height;
+    CameraView m_View;
+    int m_FramesDone;
+};
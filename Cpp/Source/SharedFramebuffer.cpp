@@ -0,0 +1,111 @@
+#include "SharedFramebuffer.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+
+SharedFramebuffer* CreateSharedFramebuffer(const char* name, int width, int height, int channels)
+{
+    printf("the shared framebuffer needs POSIX shared memory, it isn't available on Windows\n");
+    return NULL;
+}
+
+void PublishSharedFrame(SharedFramebuffer* fb, const float* backbuffer, int frameIndex, int sampleCount)
+{
+}
+
+void DestroySharedFramebuffer(SharedFramebuffer* fb)
+{
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string>
+
+// pixels start on their own cache line
+const uint32_t kSharedPixelOffset = 64;
+
+struct SharedFramebuffer
+{
+    std::string name;
+    SharedFrameHeader* header;
+    float* pixels;
+    size_t pixelBytes;
+    size_t mappedBytes;
+};
+
+SharedFramebuffer* CreateSharedFramebuffer(const char* name, int width, int height, int channels)
+{
+    static_assert(sizeof(SharedFrameHeader) <= kSharedPixelOffset, "the header overlaps the pixels");
+    const size_t pixelBytes = size_t(width) * height * channels * sizeof(float);
+    const size_t mappedBytes = kSharedPixelOffset + pixelBytes;
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        printf("can't create shared memory %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    void* mem = MAP_FAILED;
+    if (ftruncate(fd, off_t(mappedBytes)) == 0)
+        mem = mmap(NULL, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED)
+        printf("can't map %zu bytes of shared memory %s: %s\n", mappedBytes, name, strerror(errno));
+    // the mapping stays valid without the descriptor
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    SharedFramebuffer* fb = new SharedFramebuffer();
+    fb->name = name;
+    fb->header = (SharedFrameHeader*)mem;
+    fb->pixels = (float*)((char*)mem + kSharedPixelOffset);
+    fb->pixelBytes = pixelBytes;
+    fb->mappedBytes = mappedBytes;
+
+    // a viewer may already have the segment open from an earlier run, so the
+    // header is filled in under the seqlock too
+    SharedFrameHeader* h = fb->header;
+    const uint32_t seq = h->sequence.load(std::memory_order_relaxed) | 1;
+    h->sequence.store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    h->magic = kSharedFrameMagic;
+    h->version = kSharedFrameVersion;
+    h->width = width;
+    h->height = height;
+    h->channels = channels;
+    h->frameIndex = 0;
+    h->sampleCount = 0;
+    h->pixelOffset = kSharedPixelOffset;
+    memset(fb->pixels, 0, pixelBytes);
+    h->sequence.store(seq + 1, std::memory_order_release);
+    return fb;
+}
+
+void PublishSharedFrame(SharedFramebuffer* fb, const float* backbuffer, int frameIndex, int sampleCount)
+{
+    // only the renderer writes, so the sequence needs no read-modify-write
+    SharedFrameHeader* h = fb->header;
+    const uint32_t seq = h->sequence.load(std::memory_order_relaxed);
+    h->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(fb->pixels, backbuffer, fb->pixelBytes);
+    h->frameIndex = uint32_t(frameIndex);
+    h->sampleCount = uint32_t(sampleCount);
+    h->sequence.store(seq + 2, std::memory_order_release);
+}
+
+void DestroySharedFramebuffer(SharedFramebuffer* fb)
+{
+    munmap(fb->header, fb->mappedBytes);
+    shm_unlink(fb->name.c_str());
+    delete fb;
+}
+
+#endif // _WIN32
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// Publishes the backbuffer through a POSIX shared memory segment so live
+// viewers can map it and show the latest frame while a long render goes on.
+// The segment is a SharedFrameHeader followed by the pixels, width * height *
+// channels floats, bottom row first, like the backbuffer itself.
+//
+// The header's sequence works as a seqlock: it is odd while the renderer
+// updates the header and pixels and goes up by two for every published frame.
+// Viewers never take a lock, so they can't hold the renderer up; they read
+// straight out of the mapping and retry if the frame changed under them:
+//
+//   uint32_t seq;
+//   do {
+//       seq = SharedFrameBeginRead(header);
+//       ... use header fields and SharedFramePixels(header) ...
+//   } while (!SharedFrameEndRead(header, seq));
+//
+// Not available on Windows.
+
+const uint32_t kSharedFrameMagic = 0x42465450; // "PTFB"
+const uint32_t kSharedFrameVersion = 1;
+
+struct SharedFrameHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> sequence;
+    uint32_t width, height, channels; // fixed for the life of the segment
+    uint32_t frameIndex;              // of the frame now in the pixels
+    uint32_t sampleCount;             // samples per pixel behind it
+    uint32_t pixelOffset;             // bytes from the header's start to the pixels
+};
+
+inline const float* SharedFramePixels(const SharedFrameHeader* header)
+{
+    return (const float*)((const char*)header + header->pixelOffset);
+}
+
+// even sequence to hand to SharedFrameEndRead; waits out an update in progress
+inline uint32_t SharedFrameBeginRead(const SharedFrameHeader* header)
+{
+    uint32_t seq;
+    while ((seq = header->sequence.load(std::memory_order_acquire)) & 1)
+        ;
+    return seq;
+}
+
+// whether everything read since SharedFrameBeginRead belongs to one frame
+inline bool SharedFrameEndRead(const SharedFrameHeader* header, uint32_t seq)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return header->sequence.load(std::memory_order_relaxed) == seq;
+}
+
+struct SharedFramebuffer;
+
+// Creates and maps the segment, name being a POSIX shared memory name such as
+// "/pathtracer"; NULL on failure.
+SharedFramebuffer* CreateSharedFramebuffer(const char* name, int width, int height, int channels);
+// Copies a finished frame's backbuffer into the segment under the seqlock.
+void PublishSharedFrame(SharedFramebuffer* fb, const float* backbuffer, int frameIndex, int sampleCount);
+// Unmaps and unlinks the segment; viewers that still have it mapped keep it.
+void DestroySharedFramebuffer(SharedFramebuffer* fb);
@@ -0,0 +1,71 @@
+#include "SpatialHash.h"
+
+// probes before a lookup gives up on a full neighbourhood of the table
+const int kSpatialHashProbes = 16;
+
+void InitSpatialHash(SpatialHash& hash, int capacity)
+{
+    assert((capacity & (capacity - 1)) == 0);
+    hash.keys = new std::atomic<uint64_t>[capacity];
+    for (int i = 0; i < capacity; i++)
+        hash.keys[i].store(0, std::memory_order_relaxed);
+    hash.capacity = capacity;
+    hash.used = 0;
+}
+
+void FreeSpatialHash(SpatialHash& hash)
+{
+    delete[] hash.keys;
+    hash.keys = NULL;
+}
+
+static uint64_t HashKey(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+int SpatialHashCell(SpatialHash& hash, const f3& pos, const f3& normal, float cellSize, float fineRadius, bool insert)
+{
+    int level = 0;
+    const float dist = pos.length();
+    while (level < 15 && dist > fineRadius * float(1 << level))
+        level++;
+    // 18 bits per coordinate, 4 for the level, 3 for the normal's dominant axis
+    // and sign, and the top bit so no key is 0
+    const float inv = 1.0f / (cellSize * float(1 << level));
+    const uint64_t ix = uint64_t(int64_t(floorf(pos.x * inv)) + (1 << 17)) & 0x3ffff;
+    const uint64_t iy = uint64_t(int64_t(floorf(pos.y * inv)) + (1 << 17)) & 0x3ffff;
+    const uint64_t iz = uint64_t(int64_t(floorf(pos.z * inv)) + (1 << 17)) & 0x3ffff;
+    const f3 a(fabsf(normal.x), fabsf(normal.y), fabsf(normal.z));
+    const int axis = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+    const float along = axis == 0 ? normal.x : (axis == 1 ? normal.y : normal.z);
+    const uint64_t side = uint64_t(axis * 2 + (along < 0 ? 1 : 0));
+    const uint64_t key = ix | (iy << 18) | (iz << 36) | (uint64_t(level) << 54) | (side << 58) | (1ull << 63);
+
+    const int mask = hash.capacity - 1;
+    int idx = int(HashKey(key) & mask);
+    for (int probe = 0; probe < kSpatialHashProbes; probe++, idx = (idx + 1) & mask)
+    {
+        uint64_t k = hash.keys[idx].load(std::memory_order_acquire);
+        if (k == key)
+            return idx;
+        if (k != 0)
+            continue;
+        if (!insert)
+            return -1;
+        if (hash.keys[idx].compare_exchange_strong(k, key, std::memory_order_acq_rel))
+        {
+            hash.used++;
+            return idx;
+        }
+        // another thread took the cell, maybe for the same key
+        if (k == key)
+            return idx;
+    }
+    return -1;
+}
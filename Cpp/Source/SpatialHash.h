@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Maths.h"
+#include <atomic>
+
+// Lock free hash table of world space cells, shared by the path guide and the
+// radiance cache. Cells are cellSize wide within fineRadius of the origin and
+// double in size with every doubling of the distance beyond it, which keeps far
+// away surfaces from flooding the table. Each cell is split further by the
+// dominant axis of the surface normal. Cells are never removed; a table that
+// fills up just stops adding them.
+struct SpatialHash
+{
+    std::atomic<uint64_t>* keys; // 0 for a free cell
+    int capacity;                // power of two
+    std::atomic<int> used;
+};
+
+void InitSpatialHash(SpatialHash& hash, int capacity);
+void FreeSpatialHash(SpatialHash& hash);
+
+// index of the cell holding pos, -1 if there is none; with insert a missing cell
+// is added unless its neighbourhood of the table is full
+int SpatialHashCell(SpatialHash& hash, const f3& pos, const f3& normal, float cellSize, float fineRadius, bool insert);
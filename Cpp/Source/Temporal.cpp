@@ -0,0 +1,97 @@
+#include "Temporal.h"
+#include "Parallel.h"
+#include <algorithm>
+
+// relative first-hit distance difference still treated as the same surface
+const float kDisocclusionTolerance = 0.05f;
+// older history fades out so reprojection blur and lighting changes don't stick
+const float kMaxHistory = 256.0f;
+
+void AllocTemporalHistory(TemporalHistory& hist, int width, int height)
+{
+    hist.width = width;
+    hist.height = height;
+    for (int i = 0; i < 2; i++)
+    {
+        hist.color[i] = new f3[width * height];
+        hist.count[i] = new float[width * height];
+        hist.dist[i] = new float[width * height];
+    }
+    hist.current = 0;
+    hist.valid = false;
+}
+
+void FreeTemporalHistory(TemporalHistory& hist)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        delete[] hist.color[i];
+        delete[] hist.count[i];
+        delete[] hist.dist[i];
+    }
+}
+
+void ResolveTemporal(TemporalHistory& hist, const f3* color, const FirstHit* firstHits,
+    int internalWidth, int internalHeight, const Camera& cam, bool cameraMoved,
+    float* backbuffer, int channels)
+{
+    const int width = hist.width, height = hist.height;
+    const int prev = hist.current, next = prev ^ 1;
+
+    ParallelFor(height, 16, [&](int chunk, int rowBegin, int rowEnd)
+    {
+        for (int y = rowBegin; y < rowEnd; y++)
+        {
+            const int iy = y * internalHeight / height;
+            for (int x = 0; x < width; x++)
+            {
+                const int ix = x * internalWidth / width;
+                const int src = iy * internalWidth + ix;
+                const int dst = y * width + x;
+                const FirstHit& fh = firstHits[src];
+
+                f3 histColor;
+                float n = 0;
+                if (hist.valid)
+                {
+                    int p = -1;
+                    if (!cameraMoved)
+                    {
+                        p = dst;
+                    }
+                    else
+                    {
+                        float u, v;
+                        if (hist.cam.Project(fh.pos, u, v) && u >= 0 && u < 1 && v >= 0 && v < 1)
+                        {
+                            int candidate = int(v * height) * width + int(u * width);
+                            float distPrev = (fh.pos - hist.cam.origin).length();
+                            if (fabsf(distPrev - hist.dist[prev][candidate]) <= kDisocclusionTolerance * distPrev)
+                                p = candidate;
+                        }
+                    }
+                    if (p >= 0)
+                    {
+                        histColor = hist.color[prev][p];
+                        n = hist.count[prev][p];
+                    }
+                }
+
+                n = std::min(n + 1, kMaxHistory);
+                f3 col = histColor + (color[src] - histColor) * (1.0f / n);
+                hist.color[next][dst] = col;
+                hist.count[next][dst] = n;
+                hist.dist[next][dst] = fh.dist;
+
+                float* out = backbuffer + dst * channels;
+                out[0] = col.x;
+                out[1] = col.y;
+                out[2] = col.z;
+            }
+        }
+    });
+
+    hist.current = next;
+    hist.cam = cam;
+    hist.valid = true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Maths.h"
+
+// first surface seen through a pixel; sky pixels get a far point along the ray
+struct FirstHit
+{
+    f3 pos;
+    float dist; // from the camera origin
+};
+
+// Accumulated colour, sample count and first-hit distance per display pixel,
+// double buffered so reprojection can read the previous frame while writing
+// the new one.
+struct TemporalHistory
+{
+    int width, height;
+    f3* color[2];
+    float* count[2];
+    float* dist[2];
+    int current;
+    bool valid;
+    Camera cam; // camera the history was rendered with
+};
+
+void AllocTemporalHistory(TemporalHistory& hist, int width, int height);
+void FreeTemporalHistory(TemporalHistory& hist);
+
+// Blends a new frame, rendered at internalWidth x internalHeight, into the history
+// at display resolution and writes the result to the backbuffer. When the camera
+// moved, each pixel's first hit is reprojected into the previous camera; the
+// history there is reused only if its first-hit distance agrees, so disoccluded
+// pixels start over from the new frame.
+void ResolveTemporal(TemporalHistory& hist, const f3* color, const FirstHit* firstHits,
+    int internalWidth, int internalHeight, const Camera& cam, bool cameraMoved,
+    float* backbuffer, int channels);
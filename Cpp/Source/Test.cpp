@@ -1,17 +1,39 @@
 #include "Config.h"
 #include "Test.h"
 #include "Maths.h"
+#include "Memory.h"
+#include "Animation.h"
+#include "Compact.h"
+#include "Backend.h"
+#include "Compaction.h"
+#include "EnvMap.h"
+#include "LightTree.h"
+#include "Parallel.h"
+#include "PathGuide.h"
+#include "PerfCounters.h"
+#include "Primitives.h"
+#include "RadianceCache.h"
+#include "RayReorder.h"
+#include "Temporal.h"
+#include "TextureCache.h"
+#include "Timer.h"
+#include "WorkList.h"
 #include <algorithm>
-#include <atomic>
-
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#if DO_PIPELINED_FRAMES
+#include <thread>
+#endif
+
 #if DO_CUDA_RENDER
-#include "../Cuda/CudaRender.cuh"
+#include <cuda_runtime.h>
 #endif // DO_CUDA_RENDER
 
 
-static Sphere s_Spheres[] =
+// the built-in scene every renderer instance starts from
+static const Sphere s_DefaultSpheres[] =
 {
-    {f3(0,-100.5,-1), 100},
     {f3(2,0,-1), 0.5f},
     {f3(0,0,-1), 0.5f},
     {f3(-2,0,-1), 0.5f},
@@ -21,7 +43,10 @@ static Sphere s_Spheres[] =
     {f3(0.5f,1,0.5f), 0.5f},
     {f3(-1.5f,1.5f,0.f), 0.3f},
 };
-const int kSphereCount = sizeof(s_Spheres) / sizeof(s_Spheres[0]);
+const int kSphereCount = sizeof(s_DefaultSpheres) / sizeof(s_DefaultSpheres[0]);
+#if DO_COMPACT_WAVEFRONT
+static_assert(kSphereCount <= (1 << kPackedHitIdBits), "too many spheres for compact wavefront hits");
+#endif
 
 struct Material
 {
@@ -31,68 +56,299 @@ struct Material
     f3 emissive;
     float roughness;
     float ri;
+    // 1-based indices into RenderOptions::textures, 0 for the constant value;
+    // the albedo texture replaces albedo, the roughness one scales roughness by its red channel
+    int albedoTex;
+    int roughnessTex;
 };
 
-static Material s_SphereMats[kSphereCount] =
+static const Material s_DefaultSphereMats[kSphereCount] =
 {
-    { Material::Lambert, f3(0.8f, 0.8f, 0.8f), f3(0,0,0), 0, 0, },
-    { Material::Lambert, f3(0.8f, 0.4f, 0.4f), f3(0,0,0), 0, 0, },
+    { Material::Lambert, f3(0.8f, 0.4f, 0.4f), f3(0,0,0), 0, 0, 2, 0 },
     { Material::Lambert, f3(0.4f, 0.8f, 0.4f), f3(0,0,0), 0, 0, },
     { Material::Metal, f3(0.4f, 0.4f, 0.8f), f3(0,0,0), 0, 0 },
     { Material::Metal, f3(0.4f, 0.8f, 0.4f), f3(0,0,0), 0, 0 },
     { Material::Metal, f3(0.4f, 0.8f, 0.4f), f3(0,0,0), 0.2f, 0 },
-    { Material::Metal, f3(0.4f, 0.8f, 0.4f), f3(0,0,0), 0.6f, 0 },
+    { Material::Metal, f3(0.4f, 0.8f, 0.4f), f3(0,0,0), 0.6f, 0, 0, 3 },
     { Material::Dielectric, f3(0.4f, 0.4f, 0.4f), f3(0,0,0), 0, 1.5f },
     { Material::Lambert, f3(0.8f, 0.6f, 0.2f), f3(30,25,15), 0, 0 },
 };
 
-static Camera s_Cam;
+static const Material s_GroundMat = { Material::Lambert, f3(0.8f, 0.8f, 0.8f), f3(0,0,0), 0, 0, 1, 0 };
+
+// one renderer instance's copy of the scene; animation moves its spheres. The
+// other primitives have their materials per pool, by id.
+struct Scene
+{
+    Sphere spheres[kSphereCount];
+    Material mats[kSphereCount];
+    PrimitivePools prims;
+    std::vector<Material> primMats[kPrimTypeCount];
+};
+
+static void LoadDefaultScene(Scene& scene)
+{
+    for (int i = 0; i < kSphereCount; ++i)
+    {
+        scene.spheres[i] = s_DefaultSpheres[i];
+        scene.spheres[i].UpdateDerivedData();
+        scene.mats[i] = s_DefaultSphereMats[i];
+    }
+    // the ground, at the bottom of the spheres
+    scene.prims = PrimitivePools();
+    for (int t = 0; t < kPrimTypeCount; t++)
+        scene.primMats[t].clear();
+    AddPlane(scene.prims, f3(0, 1, 0), -0.5f);
+    scene.primMats[kPrimPlane].push_back(s_GroundMat);
+}
+
+static const Material& SceneMaterial(const Scene& scene, const Hit& rec)
+{
+    return rec.type == kPrimSphere ? scene.mats[rec.id] : scene.primMats[rec.type][rec.id];
+}
+
+#if DO_ANIMATION
+#if DO_PIPELINED_FRAMES
+#error "animated spheres are shared by all frames in flight, use either DO_ANIMATION or DO_PIPELINED_FRAMES"
+#endif
+
+// the glass sphere bobs up and down, the light circles above the scene
+static const SphereKey s_GlassKeys[] =
+{
+    { 0.0f, f3(0.5f, 1.0f, 0.5f), 0.5f },
+    { 1.0f, f3(0.5f, 1.4f, 0.5f), 0.5f },
+    { 2.0f, f3(0.5f, 1.0f, 0.5f), 0.5f },
+};
+static const SphereKey s_LightKeys[] =
+{
+    { 0.0f, f3(-1.5f, 1.5f, 0.0f), 0.3f },
+    { 1.0f, f3(0.0f, 1.5f, -1.5f), 0.3f },
+    { 2.0f, f3(1.5f, 1.5f, 0.0f), 0.25f },
+    { 3.0f, f3(0.0f, 1.5f, 1.5f), 0.3f },
+    { 4.0f, f3(-1.5f, 1.5f, 0.0f), 0.3f },
+};
+static const SphereTrack s_SphereTracks[] =
+{
+    { 6, s_GlassKeys, sizeof(s_GlassKeys) / sizeof(s_GlassKeys[0]) },
+    { 7, s_LightKeys, sizeof(s_LightKeys) / sizeof(s_LightKeys[0]) },
+};
+const int kSphereTrackCount = sizeof(s_SphereTracks) / sizeof(s_SphereTracks[0]);
+#endif // DO_ANIMATION
 
 const float kMinT = 0.001f;
 const float kMaxT = 1.0e7f;
 const int kMaxDepth = 10;
+const int kShadeChunk = 4096;
+const float kSkyDistance = 1.0e4f;
+// ray cone spread after a diffuse bounce, about the width of the cosine lobe
+const float kDiffuseConeSpread = 0.5f;
+const int kMaxTextures = 16;
+// share of guided diffuse directions once a guide cell is ready, the rest are
+// cosine sampled; and how many diffuse vertices back a contribution trains
+const float kGuideFraction = 0.5f;
+const int kGuideVertices = 3;
+// diffuse bounces back a contribution reaches in the radiance cache
+const int kCacheVertices = 4;
+// one in this many paths, a different set every frame, trains the radiance
+// cache and traces on to the end; the others end in the cache where they can
+const int kCacheTrainingRatio = 8;
+
+#if DO_PIPELINED_FRAMES
+const int kFramesInFlight = 2;
+#else
+const int kFramesInFlight = 1;
+#endif
+
+enum PerfStage
+{
+    kStageCameraRays,
+    kStageTrace,   // primary intersection, with the sort under DO_RAY_REORDER
+    kStageShade,
+    kStageShadow,  // compacting, tracing and resolving shadow rays
+    kStageCompact,
+    kStageAccumulate,
+    kStageCount
+};
+
+#if DO_PERF_COUNTERS
+#if DO_PIPELINED_FRAMES
+#error "frames in flight overlap their stages, use either DO_PERF_COUNTERS or DO_PIPELINED_FRAMES"
+#endif
+
+static const char* const s_StageNames[kStageCount] = { "camera rays", "trace", "shade", "shadow rays", "compact", "accumulate" };
+
+// counter deltas per stage and depth; camera rays and accumulation count as depth 0
+struct PerfProfile
+{
+    PerfCounts counts[kStageCount][kMaxDepth + 1];
+    double rays[kMaxDepth + 1]; // path and shadow rays traced
+};
+#endif // DO_PERF_COUNTERS
+
+#if DO_RAY_REORDER
+// per depth intersection time without [0] and with [1] reordering
+struct ReorderProfile
+{
+    double traceTime[2][kMaxDepth + 1];
+    double rays[2][kMaxDepth + 1];
+    double sortTime[kMaxDepth + 1];
+};
+#endif // DO_RAY_REORDER
+
+// running mean and sum of squared deviations of a pixel's per frame luminance
+struct PixelStats
+{
+    float mean;
+    float m2;
+};
+
+// the error estimate needs a few frames before the variance means anything
+const int kMinErrorFrames = 4;
+
+// the cache and the cache id of every RenderOptions texture, 0 if it didn't open
+struct SceneTextures
+{
+    TextureCache* cache;
+    int ids[kMaxTextures];
+    int count;
+};
+
+// a diffuse bounce waiting for the radiance its path brings back: the guide
+// cell and direction bin, the bounce depth, and 1 / (throughput * pdf) to turn
+// a later contribution into an estimate of the radiance integral over the bin
+struct GuideVertex
+{
+    int cell;
+    int16_t bin;
+    int16_t depth;
+    float weight;
+};
+
+// a diffuse bounce gathering the light that leaves it for the radiance cache:
+// its cell, its depth and the throughput that reached it
+struct CacheVertex
+{
+    int cell;
+    int depth;
+    f3 throughput;
+};
+
+// one view of a multi-view batch and where its rays sit in the shared wavefront
+struct BatchView
+{
+    Camera cam;
+    WorkList work;
+    float* backbuffer;
+    int screenWidth, screenHeight;
+    int firstRay;
+};
 
 struct RendererData
 {
     int frameCount;
     int screenWidth, screenHeight;
     float* backbuffer;
+    const Scene* scene;
     Camera* cam;
-    int numRays;
-    Ray* rays;
-    Hit* hits;
-    Sample* samples;
-#if DO_CUDA_RENDER
-    DeviceData deviceData;
-#endif // DO_CUDA_RENDER
+    const WorkList* work;
+    int numRays, maxRays;
+    WaveRay* rays;
+    WaveHit* hits;
+    WaveSample* samples;
+    // sample index of every ray, survivor flags, and the compaction targets
+    int* sIndices;
+    uint8_t* alive;
+    WaveRay* raysScratch;
+    int* sIndicesScratch;
+    // per ray first hits, only recorded for interactive rendering
+    FirstHit* firstHits;
+    // per pixel statistics, only kept when rendering to an error target
+    PixelStats* pixelStats;
+    // environment lighting, NULL for the built-in sky, and the emissive spheres
+    const EnvMap* env;
+    const LightTree* lights;
+    // With DO_ENV_SAMPLING or DO_LIGHT_SAMPLING each diffuse hit also casts a
+    // shadow ray toward a sampled light; its MIS weighted contribution waits in
+    // shadowContrib until the ray is traced, and counts if the ray reaches
+    // shadowTarget (a sphere, or -1 for the environment). misPdf holds the BSDF
+    // pdf of the direction a path continued in, 0 when the vertex it left didn't
+    // sample lights; misPos and misNormal are that vertex, for the light tree pmf.
+    WaveRay* shadowRays;
+    uint8_t* shadowAlive;
+    f3* shadowContrib;
+    int* shadowTarget;
+    float* misPdf;
+    f3* misPos;
+    f3* misNormal;
+    // textures, NULL without any; a ray cone per sample picks their mip levels
+    const SceneTextures* textures;
+    float* coneWidth;
+    float* coneSpread;
+    // with DO_PATH_GUIDING, the guide and the last kGuideVertices diffuse bounces
+    // of every sample, a ring indexed by guideCount % kGuideVertices
+    PathGuide* guide;
+    GuideVertex* guideVertices;
+    uint8_t* guideCount;
+    // with RenderOptions::radianceCacheDepth, the cache diffuse paths end in from
+    // cacheDepth on, and the ring of each sample's last kCacheVertices bounces
+    RadianceCache* radianceCache;
+    int cacheDepth;
+    CacheVertex* cacheVertices;
+    uint8_t* cacheCount;
+    // multi-view batches share one wavefront; views replaces cam, work and
+    // backbuffer, and sampleViews tags every sample with its view. NULL for a
+    // single view
+    const BatchView* views;
+    int numViews;
+    uint16_t* sampleViews;
+    // optional, called between the bounces of a frame; see RenderJob::bounceDone
+    void (*bounceDone)(void* user);
+    void* bounceUser;
+    IntersectBackend* backend;
+#if DO_RAY_REORDER
+    ReorderBuffers reorder;
+    ReorderProfile* profile;
+#endif // DO_RAY_REORDER
+#if DO_PERF_COUNTERS
+    PerfProfile* perf;
+#endif // DO_PERF_COUNTERS
 };
 
-
-void HitWorld(const Ray* rays, const int num_rays, float tMin, float tMax, Hit* hits)
+// adds what the counters moved since mark to a stage, and moves mark up to now
+static void CountStage(const RendererData& data, int stage, int depth, PerfReading& mark)
 {
-    for (int rIdx = 0; rIdx < num_rays; rIdx++)
-    {
-        const Ray& r = rays[rIdx];
+#if DO_PERF_COUNTERS
+    PerfReading now;
+    ReadPerfCounters(now);
+    AddPerfCountsSince(mark, now, data.perf->counts[stage][depth]);
+    mark.raw.swap(now.raw);
+#endif // DO_PERF_COUNTERS
+}
 
-        float closest = tMax, hitT;
-        int hitId = -1;
-        for (int i = 0; i < kSphereCount; ++i)
-        {
-            if (HitSphere(r, s_Spheres[i], tMin, closest, hitT))
-            {
-                closest = hitT;
-                hitId = i;
-            }
-        }
+static void StartStages(PerfReading& mark)
+{
+#if DO_PERF_COUNTERS
+    ReadPerfCounters(mark);
+#endif // DO_PERF_COUNTERS
+}
 
-        hits[rIdx] = Hit(hitT, hitId);
-    }
+// Unit normal at a hit point. Planes, disks and quads are one sided surfaces in
+// the pools, here they face the incoming ray like the outside of a sphere would.
+static f3 HitNormal(const RendererData& data, const Ray& r, const Hit& rec, const f3& hitPos)
+{
+    if (rec.type == kPrimSphere)
+        return data.scene->spheres[rec.id].normalAt(hitPos);
+    f3 n = PrimitiveNormal(data.scene->prims, rec.type, rec.id, hitPos);
+    if (rec.type != kPrimBox && dot(n, r.dir) > 0)
+        n = -n;
+    return n;
 }
 
-static bool ScatterNoLightSampling(const Material& mat, const Ray& r_in, const Hit& rec, f3& attenuation, Ray& scattered, uint32_t& state)
-{
-    const f3 hitPos = r_in.pointAt(rec.t);
-    const f3 hitNormal = s_Spheres[rec.id].normalAt(hitPos);
+
+static bool ScatterNoLightSampling(const RendererData& data, const Material& mat, const Ray& r_in, const Hit& rec, f3& attenuation, Ray& scattered, uint32_t& state)
+{
+    const f3 hitPos = r_in.pointAt(rec.t);
+    const f3 hitNormal = HitNormal(data, r_in, rec, hitPos);
 
     if (mat.type == Material::Lambert)
     {
@@ -160,183 +416,1376 @@ static bool ScatterNoLightSampling(const Material& mat, const Ray& r_in, const H
     return true;
 }
 
-static void TraceIterative(const RendererData& data, int& inoutRayCount, uint32_t& state)
-{
-    int numRays = data.numRays;
-    int* sIndices = new int[numRays];
-    for (int rIdx = 0; rIdx < numRays; rIdx++)
-    {
-        Sample& sample = data.samples[rIdx];
-        sample.color = f3(0, 0, 0);
-        sample.attenuation = f3(1, 1, 1);
-        sIndices[rIdx] = rIdx;
-    }
+// power heuristic with beta = 2
+static float MisWeight(float pdf, float otherPdf)
+{
+    return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
 
-    for (int depth = 0; depth <= kMaxDepth && numRays > 0; depth++)
-    {
-#if DO_CUDA_RENDER
-        HitWorldDevice(data.rays, numRays, kMinT, kMaxT, data.hits, data.deviceData);
-#else
-        HitWorld(data.rays, numRays, kMinT, kMaxT, data.hits);
-#endif
-        int wIdx = 0;
-        for (int rIdx = 0; rIdx < numRays; rIdx++)
+// Trains the guide and the radiance cache with a contribution the sample received
+// at the given depth, through the diffuse bounces before it. The light a shadow
+// ray brings to a bounce also leaves it, so it counts for that bounce's cache
+// cell, but it didn't arrive from the direction the guide recorded.
+static void LearnContribution(const RendererData& data, const int sIdx, const int depth, const f3& contribution, const bool shadowRay)
+{
+    const float lum = 0.2126f * contribution.x + 0.7152f * contribution.y + 0.0722f * contribution.z;
+    if (!(lum > 0))
+        return;
+    if (data.guide != NULL)
+    {
+        const int count = std::min(int(data.guideCount[sIdx]), kGuideVertices);
+        for (int i = 0; i < count; i++)
+        {
+            const GuideVertex& v = data.guideVertices[sIdx * kGuideVertices + i];
+            if (v.depth < depth)
+                SplatGuide(data.guide, v.cell, v.bin, lum * v.weight);
+        }
+    }
+    if (data.radianceCache != NULL)
+    {
+        const int count = std::min(int(data.cacheCount[sIdx]), kCacheVertices);
+        for (int i = 0; i < count; i++)
         {
-            const Ray& r = data.rays[rIdx];
-            const int sIdx = sIndices[rIdx];
+            const CacheVertex& v = data.cacheVertices[sIdx * kCacheVertices + i];
+            if (v.depth < depth || (shadowRay && v.depth == depth))
+            {
+                const f3& t = v.throughput;
+                SplatRadianceCache(data.radianceCache, v.cell, f3(t.x > 0 ? contribution.x / t.x : 0, t.y > 0 ? contribution.y / t.y : 0, t.z > 0 ? contribution.z / t.z : 0));
+            }
+        }
+    }
+}
+
+static bool TrainsRadianceCache(const RendererData& data, const int sIdx)
+{
+    return (uint32_t(sIdx) * 2654435761u + uint32_t(data.frameCount) * 40503u) % kCacheTrainingRatio == 0;
+}
+
+// starts a radiance cache estimate at a diffuse bounce the path continues from
+static void RecordCacheVertex(const RendererData& data, const Ray& r, const Hit& rec, const int sIdx, const int depth, const f3& throughput)
+{
+    const f3 hitPos = r.pointAt(rec.t);
+    const int cell = RadianceCacheCell(data.radianceCache, hitPos, HitNormal(data, r, rec, hitPos), true);
+    if (cell < 0)
+        return;
+    AddRadianceCacheSample(data.radianceCache, cell);
+    CacheVertex& v = data.cacheVertices[sIdx * kCacheVertices + data.cacheCount[sIdx] % kCacheVertices];
+    v.cell = cell;
+    v.depth = depth;
+    v.throughput = throughput;
+    data.cacheCount[sIdx]++;
+}
+
+// Ends a path at a diffuse, non emissive hit from cacheDepth on, if the hit's
+// cell is ready, by adding the cached radiance instead of tracing on. Emitters
+// go on as usual since their emission takes part in light sampling MIS.
+static bool EndInRadianceCache(const RendererData& data, const Material& mat, const Ray& r, const Hit& rec, const int sIdx, const int depth)
+{
+    if (depth < data.cacheDepth || mat.type != Material::Lambert || mat.emissive.x + mat.emissive.y + mat.emissive.z > 0 || TrainsRadianceCache(data, sIdx))
+        return false;
+    const f3 hitPos = r.pointAt(rec.t);
+    f3 radiance;
+    if (!RadianceCacheLookup(data.radianceCache, RadianceCacheCell(data.radianceCache, hitPos, HitNormal(data, r, rec, hitPos), false), radiance))
+        return false;
+    Sample sample = LoadSample(data.samples[sIdx]);
+    const f3 contribution = sample.attenuation * radiance;
+    sample.color += contribution;
+    StoreSample(data.samples[sIdx], sample);
+    LearnContribution(data, sIdx, depth, contribution, false);
+    return true;
+}
+
+// density of a diffuse direction under the path's own sampling, the cosine lobe
+// mixed with the guide where its cell is ready
+static float DiffusePdf(const RendererData& data, const int cell, const f3& normal, const f3& dir)
+{
+    const float cosPdf = std::max(0.0f, dot(dir, normal)) / kPI;
+    if (!GuideReady(data.guide, cell))
+        return cosPdf;
+    return (1.0f - kGuideFraction) * cosPdf + kGuideFraction * GuidePdf(data.guide, cell, dir);
+}
+
+// Lambert scattering with path guiding, and recording of the bounce for training
+static bool ScatterGuided(const RendererData& data, const Material& mat, const Ray& r_in, const Hit& rec, const int sIdx, const int depth,
+    const f3& throughput, f3& attenuation, Ray& scattered, float& pdf, uint32_t& state)
+{
+    const f3 hitPos = r_in.pointAt(rec.t);
+    const f3 hitNormal = HitNormal(data, r_in, rec, hitPos);
+    const int cell = GuideCell(data.guide, hitPos, hitNormal, true);
+    f3 dir;
+    if (GuideReady(data.guide, cell) && RandomFloat01(state) < kGuideFraction)
+    {
+        float guidePdf;
+        dir = SampleGuide(data.guide, cell, state, guidePdf);
+    }
+    else
+        dir = normalize(hitNormal + RandomUnitVector(state));
+    const float cosine = dot(dir, hitNormal);
+    if (cosine <= 0)
+        return false;
+    pdf = DiffusePdf(data, cell, hitNormal, dir);
+    attenuation = mat.albedo * (cosine / kPI / pdf);
+    scattered = Ray(hitPos, dir);
 
-            const Hit& rec = data.hits[rIdx];
-            Sample& sample = data.samples[sIdx];
+    const f3 t = throughput * attenuation;
+    const float lum = 0.2126f * t.x + 0.7152f * t.y + 0.0722f * t.z;
+    if (cell >= 0 && lum > 0)
+    {
+        GuideVertex& v = data.guideVertices[sIdx * kGuideVertices + data.guideCount[sIdx] % kGuideVertices];
+        v.cell = cell;
+        v.bin = int16_t(GuideBin(dir));
+        v.depth = int16_t(depth);
+        v.weight = 1.0f / (lum * pdf);
+        data.guideCount[sIdx]++;
+    }
+    return true;
+}
+
+// chance that a light sample goes to the environment instead of the spheres
+static float EnvSelectProb(const RendererData& data)
+{
+    const bool env = DO_ENV_SAMPLING && data.env != NULL && data.env->canSample;
+    const bool spheres = DO_LIGHT_SAMPLING && data.lights != NULL && !data.lights->Empty();
+    return env ? (spheres ? 0.5f : 1.0f) : 0.0f;
+}
+
+// density with which the path's previous vertex would have light sampled the
+// direction toward an emissive sphere it hit
+static float SphereLightPdf(const RendererData& data, const int sIdx, const int sphere)
+{
+    const f3& p = data.misPos[sIdx];
+    float pmf = LightTreePmf(*data.lights, p, data.misNormal[sIdx], sphere);
+    return (1.0f - EnvSelectProb(data)) * pmf * SphereConePdf(data.scene->spheres[sphere], p);
+}
+
+// Next event estimation at diffuse hits, toward the environment or an emissive
+// sphere picked by the light tree. Returns whether a shadow ray was written; its
+// contribution, MIS weighted against the cosine lobe the path continues with,
+// is stored for the sample.
+static bool SampleLight(const RendererData& data, const Material& mat, const Ray& r, const Hit& rec, const int sIdx, WaveRay& shadowRay, uint32_t& state)
+{
+    if (mat.type != Material::Lambert)
+        return false;
+    const f3 hitPos = r.pointAt(rec.t);
+    const f3 hitNormal = HitNormal(data, r, rec, hitPos);
+    const float envSelect = EnvSelectProb(data);
+
+    f3 dir, radiance;
+    float lightPdf;
+    int target = -1;
+    if (RandomFloat01(state) < envSelect)
+    {
+        radiance = SampleEnvMap(*data.env, state, dir, lightPdf);
+        lightPdf *= envSelect;
+    }
+    else
+    {
+        float pmf, conePdf;
+        target = SampleLightTree(*data.lights, hitPos, hitNormal, RandomFloat01(state), pmf);
+        if (target < 0 || (rec.type == kPrimSphere && target == rec.id) || !SampleSphereCone(data.scene->spheres[target], hitPos, state, dir, conePdf))
+            return false;
+        radiance = data.scene->mats[target].emissive;
+        lightPdf = (1.0f - envSelect) * pmf * conePdf;
+    }
+    float cosine = dot(dir, hitNormal);
+    if (cosine <= 0 || lightPdf <= 0)
+        return false;
+
+    const float bsdfPdf = cosine / kPI;
+    // MIS against the density the path picks its next direction with
+    float pathPdf = bsdfPdf;
+    if (data.guide != NULL)
+        pathPdf = DiffusePdf(data, GuideCell(data.guide, hitPos, hitNormal, false), hitNormal, dir);
+    const f3 attenuation = LoadSample(data.samples[sIdx]).attenuation;
+    data.shadowContrib[sIdx] = attenuation * mat.albedo * radiance * (bsdfPdf / lightPdf * MisWeight(lightPdf, pathPdf));
+    data.shadowTarget[sIdx] = target;
+    StoreRay(shadowRay, Ray(hitPos, dir));
+    return true;
+}
+
+// shades one ray of the current bounce with the material of its hit, writing its
+// scattered ray in place; returns whether the path survives into the next bounce
+static bool ShadeRay(const RendererData& data, const Material& mat, WaveRay& ray, const Hit& rec, const int sIdx, const int depth, uint32_t& state)
+{
+    const Ray r = LoadRay(ray);
+    Sample sample = LoadSample(data.samples[sIdx]);
+    bool alive = false;
 
-            ++inoutRayCount;
-            if (rec.id >= 0)
+    if (rec.id >= 0)
+    {
+        Ray scattered;
+        f3 local_attenuation;
+        f3 emitted = mat.emissive;
+        if (DO_LIGHT_SAMPLING && data.misPos != NULL && data.misPdf[sIdx] > 0 && rec.type == kPrimSphere && data.lights->sphereLights[rec.id] >= 0)
+            emitted = emitted * MisWeight(data.misPdf[sIdx], SphereLightPdf(data, sIdx, rec.id));
+        sample.color += emitted * sample.attenuation;
+        LearnContribution(data, sIdx, depth, emitted * sample.attenuation, false);
+        if (data.radianceCache != NULL && mat.type == Material::Lambert && depth < kMaxDepth && TrainsRadianceCache(data, sIdx))
+            RecordCacheVertex(data, r, rec, sIdx, depth, sample.attenuation);
+        float diffusePdf = 0;
+        bool scatters;
+        if (depth >= kMaxDepth)
+            scatters = false;
+        else if (data.guide != NULL && mat.type == Material::Lambert)
+            scatters = ScatterGuided(data, mat, r, rec, sIdx, depth, sample.attenuation, local_attenuation, scattered, diffusePdf, state);
+        else
+            scatters = ScatterNoLightSampling(data, mat, r, rec, local_attenuation, scattered, state);
+        if (scatters)
+        {
+            sample.attenuation *= local_attenuation;
+            StoreRay(ray, scattered);
+            alive = true;
+            if (data.misPdf != NULL)
             {
-                Ray scattered;
-                const Material& mat = s_SphereMats[rec.id];
-                f3 local_attenuation;
-                sample.color += mat.emissive * sample.attenuation;
-                if (depth < kMaxDepth && ScatterNoLightSampling(mat, r, rec, local_attenuation, scattered, state))
+                // the diffuse lobe is the one light sampling competes with
+                const f3 n = HitNormal(data, r, rec, scattered.orig);
+                if (mat.type != Material::Lambert)
+                    data.misPdf[sIdx] = 0;
+                else
+                    data.misPdf[sIdx] = data.guide != NULL ? diffusePdf : std::max(0.0f, dot(scattered.dir, n)) / kPI;
+                if (data.misPos != NULL)
                 {
-                    sample.attenuation *= local_attenuation;
-                    data.rays[wIdx] = scattered;
-                    sIndices[wIdx] = sIdx;
-                    wIdx++;
+                    data.misPos[sIdx] = scattered.orig;
+                    data.misNormal[sIdx] = n;
                 }
             }
-            else
-            {
-                // sky
+        }
+    }
+    else if (data.env != NULL)
+    {
+        float weight = 1;
+        if (data.misPdf != NULL && data.misPdf[sIdx] > 0)
+            weight = MisWeight(data.misPdf[sIdx], EnvSelectProb(data) * EnvMapPdf(*data.env, r.dir));
+        sample.color += sample.attenuation * EnvMapRadiance(*data.env, r.dir) * weight;
+        LearnContribution(data, sIdx, depth, sample.attenuation * EnvMapRadiance(*data.env, r.dir) * weight, false);
+    }
+    else
+    {
+        // sky
 #if DO_MITSUBA_COMPARE
-                sample.color += sample.attenuation * f3(0.15f, 0.21f, 0.3f); // easier compare with Mitsuba's constant environment light
+        f3 sky = f3(0.15f, 0.21f, 0.3f); // easier compare with Mitsuba's constant environment light
 #else
-                f3 unitDir = r.dir;
-                float t = 0.5f*(unitDir.y + 1.0f);
-                sample.color += sample.attenuation * ((1.0f - t)*f3(1.0f, 1.0f, 1.0f) + t * f3(0.5f, 0.7f, 1.0f)) * 0.3f;
+        f3 unitDir = r.dir;
+        float t = 0.5f*(unitDir.y + 1.0f);
+        f3 sky = ((1.0f - t)*f3(1.0f, 1.0f, 1.0f) + t * f3(0.5f, 0.7f, 1.0f)) * 0.3f;
 #endif
+        sample.color += sample.attenuation * sky;
+        LearnContribution(data, sIdx, depth, sample.attenuation * sky, false);
+    }
+    StoreSample(data.samples[sIdx], sample);
+    return alive;
+}
+
+// Material of a hit with its textures looked up. Also grows the sample's ray cone
+// to the hit and widens it for the bounce, the cone's width on the surface picks
+// the mip level. Sphere uvs are longitude and latitude around the sphere's y axis,
+// the other primitives' come from PrimitiveUv and repeat.
+static Material HitMaterial(const RendererData& data, const Ray& r, const Hit& rec, const int sIdx)
+{
+    Material mat = SceneMaterial(*data.scene, rec);
+    if (data.textures == NULL)
+        return mat;
+
+    const f3 hitPos = r.pointAt(rec.t);
+    const f3 n = HitNormal(data, r, rec, hitPos);
+    const float width = data.coneWidth[sIdx] + data.coneSpread[sIdx] * rec.t;
+    data.coneWidth[sIdx] = width;
+    if (mat.type == Material::Lambert)
+        data.coneSpread[sIdx] = kDiffuseConeSpread;
+    else if (mat.type == Material::Metal)
+        data.coneSpread[sIdx] += mat.roughness;
+
+    float u, v, uvLength;
+    if (rec.type == kPrimSphere)
+    {
+        u = 0.5f + atan2f(n.z, n.x) * (0.5f / kPI);
+        v = acosf(std::min(1.0f, std::max(-1.0f, n.y))) * (1.0f / kPI);
+        uvLength = 2.0f * kPI * data.scene->spheres[rec.id].radius;
+    }
+    else
+    {
+        PrimitiveUv(data.scene->prims, rec.type, rec.id, hitPos, u, v, uvLength);
+        u -= floorf(u);
+        v -= floorf(v);
+    }
+    // the cone's cross section, stretched by the grazing angle, over the world length of the uv range
+    const float footprint = width / (uvLength * std::max(fabsf(dot(r.dir, n)), 0.1f));
+    const SceneTextures& tex = *data.textures;
+    if (mat.albedoTex > 0 && mat.albedoTex <= tex.count && tex.ids[mat.albedoTex - 1] != 0)
+        mat.albedo = SampleTexture(tex.cache, tex.ids[mat.albedoTex - 1], u, v, footprint);
+    if (mat.roughnessTex > 0 && mat.roughnessTex <= tex.count && tex.ids[mat.roughnessTex - 1] != 0)
+        mat.roughness *= SampleTexture(tex.cache, tex.ids[mat.roughnessTex - 1], u, v, footprint).x;
+    return mat;
+}
+
+// angle between neighbouring pixels' camera rays
+static float PixelSpread(const Camera& cam, int screenHeight)
+{
+    return cam.vertical.length() / (dot(cam.origin - cam.lowerLeftCorner, cam.w) * screenHeight);
+}
+
+static uint32_t HashSeed(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x | 1;
+}
+
+static void TraceIterative(const RendererData& data, int& inoutRayCount, uint32_t& state)
+{
+    int numRays = data.numRays;
+    WaveRay* rays = data.rays;
+    int* sIndices = data.sIndices;
+    WaveRay* raysNext = data.raysScratch;
+    int* sIndicesNext = data.sIndicesScratch;
+    const float pixelSpread = data.views != NULL ? 0.0f : PixelSpread(*data.cam, data.screenHeight);
+
+    ParallelFor(numRays, kShadeChunk, [&](int chunk, int begin, int end)
+    {
+        for (int rIdx = begin; rIdx < end; rIdx++)
+        {
+            StoreSample(data.samples[rIdx], Sample());
+            sIndices[rIdx] = rIdx;
+            if (data.misPdf != NULL)
+                data.misPdf[rIdx] = 0;
+            if (data.coneWidth != NULL)
+            {
+                data.coneWidth[rIdx] = 0;
+                if (data.views != NULL)
+                {
+                    const BatchView& view = data.views[data.sampleViews[rIdx]];
+                    data.coneSpread[rIdx] = PixelSpread(view.cam, view.screenHeight);
+                }
+                else
+                    data.coneSpread[rIdx] = pixelSpread;
+            }
+            if (data.guide != NULL)
+                data.guideCount[rIdx] = 0;
+            if (data.radianceCache != NULL)
+                data.cacheCount[rIdx] = 0;
+        }
+    });
+
+    const uint32_t frameSeed = state;
+    for (int depth = 0; depth <= kMaxDepth && numRays > 0; depth++)
+    {
+        // only the compacted wavefront is in flight here, a good place to hold
+        // the job while more urgent work has the thread pool
+        if (depth > 0 && data.bounceDone != NULL)
+            data.bounceDone(data.bounceUser);
+        PerfReading mark;
+        StartStages(mark);
+#if DO_RAY_REORDER
+        // sort incoherent secondary rays so that neighbouring rays traverse the same spheres
+#if DO_REORDER_PROFILE
+        // every other frame, at all depths, to compare both variants on the same scene
+        const int reorder = data.frameCount & 1;
+#else
+        const int reorder = depth >= kReorderMinDepth ? 1 : 0;
+#endif
+        double t0 = NowSeconds();
+        if (reorder)
+        {
+            ReorderRays(rays, sIndices, numRays, raysNext, sIndicesNext, data.reorder);
+            std::swap(rays, raysNext);
+            std::swap(sIndices, sIndicesNext);
+        }
+        double t1 = NowSeconds();
+#endif // DO_RAY_REORDER
+
+        data.backend->Trace(rays, numRays, kMinT, kMaxT, data.hits);
+
+        if (depth == 0 && data.firstHits != NULL)
+        {
+            ParallelFor(numRays, kShadeChunk, [&](int chunk, int begin, int end)
+            {
+                for (int rIdx = begin; rIdx < end; rIdx++)
+                {
+                    const Ray r = LoadRay(rays[rIdx]);
+                    const Hit rec = LoadHit(data.hits[rIdx]);
+                    float t = rec.id >= 0 ? rec.t : kSkyDistance;
+                    FirstHit& fh = data.firstHits[sIndices[rIdx]];
+                    fh.pos = r.pointAt(t);
+                    fh.dist = (fh.pos - data.cam->origin).length();
+                }
+            });
+        }
+
+#if DO_RAY_REORDER
+        data.profile->sortTime[depth] += t1 - t0;
+        data.profile->traceTime[reorder][depth] += NowSeconds() - t1;
+        data.profile->rays[reorder][depth] += numRays;
+#endif // DO_RAY_REORDER
+        CountStage(data, kStageTrace, depth, mark);
+
+        // shade in fixed-size chunks with one random stream per chunk, so the result
+        // doesn't depend on the number of threads
+        ParallelFor(numRays, kShadeChunk, [&](int chunk, int begin, int end)
+        {
+            uint32_t chunkState = HashSeed(frameSeed ^ HashSeed(depth * 7919 + chunk));
+            for (int rIdx = begin; rIdx < end; rIdx++)
+            {
+                const Hit rec = LoadHit(data.hits[rIdx]);
+                const int sIdx = sIndices[rIdx];
+                Material mat = {};
+                if (rec.id >= 0)
+                    mat = HitMaterial(data, LoadRay(rays[rIdx]), rec, sIdx);
+                if (data.radianceCache != NULL && rec.id >= 0 && EndInRadianceCache(data, mat, LoadRay(rays[rIdx]), rec, sIdx, depth))
+                {
+                    data.alive[rIdx] = 0;
+                    if (data.shadowRays != NULL)
+                        data.shadowAlive[rIdx] = 0;
+                    continue;
+                }
+                if (data.shadowRays != NULL)
+                    data.shadowAlive[rIdx] = rec.id >= 0 && SampleLight(data, mat, LoadRay(rays[rIdx]), rec, sIdx, data.shadowRays[rIdx], chunkState);
+                data.alive[rIdx] = ShadeRay(data, mat, rays[rIdx], rec, sIdx, depth, chunkState);
             }
-        }
-
-        numRays = wIdx;
-    }
-
-    delete[] sIndices;
+        });
+        inoutRayCount += numRays;
+        CountStage(data, kStageShade, depth, mark);
+#if DO_PERF_COUNTERS
+        data.perf->rays[depth] += numRays;
+#endif // DO_PERF_COUNTERS
+
+        if (data.shadowRays != NULL)
+        {
+            // the next arrays and the hits are free until the survivors get compacted
+            int numShadow = CompactSurvivors(data.shadowAlive, numRays, data.shadowRays, sIndices, raysNext, sIndicesNext);
+            data.backend->Trace(raysNext, numShadow, kMinT, kMaxT, data.hits);
+            ParallelFor(numShadow, kShadeChunk, [&](int chunk, int begin, int end)
+            {
+                for (int i = begin; i < end; i++)
+                {
+                    const int sIdx = sIndicesNext[i];
+                    // misses keep the sphere type, so an environment target matches them too
+                    const Hit hit = LoadHit(data.hits[i]);
+                    if (hit.id != data.shadowTarget[sIdx] || hit.type != kPrimSphere)
+                        continue;
+                    Sample sample = LoadSample(data.samples[sIdx]);
+                    sample.color += data.shadowContrib[sIdx];
+                    StoreSample(data.samples[sIdx], sample);
+                    LearnContribution(data, sIdx, depth, data.shadowContrib[sIdx], true);
+                }
+            });
+            inoutRayCount += numShadow;
+            CountStage(data, kStageShadow, depth, mark);
+#if DO_PERF_COUNTERS
+            data.perf->rays[depth] += numShadow;
+#endif // DO_PERF_COUNTERS
+        }
+
+        numRays = CompactSurvivors(data.alive, numRays, rays, sIndices, raysNext, sIndicesNext);
+        std::swap(rays, raysNext);
+        std::swap(sIndices, sIndicesNext);
+        CountStage(data, kStageCompact, depth, mark);
+    }
 }
 
-static int TracePixels(RendererData data)
+static void GenerateCameraRays(const RendererData& data, uint32_t& state)
 {
-    float* backbuffer = data.backbuffer;
     float invWidth = 1.0f / data.screenWidth;
     float invHeight = 1.0f / data.screenHeight;
+    const WorkList& work = *data.work;
+
+    for (int i = 0, rIdx = 0; i < work.numPixels; i++)
+    {
+        const int x = work.pixels[i] % data.screenWidth;
+        const int y = work.pixels[i] / data.screenWidth;
+        for (int s = WorkListPixelRays(work, i); s > 0; s--, ++rIdx)
+        {
+            float u = float(x + RandomFloat01(state)) * invWidth;
+            float v = float(y + RandomFloat01(state)) * invHeight;
+            StoreRay(data.rays[rIdx], data.cam->GetRay(u, v, state));
+        }
+    }
+}
+
+static void AccumulateSamples(const RendererData& data)
+{
     float lerpFac = float(data.frameCount) / float(data.frameCount + 1);
-#if !DO_PROGRESSIVE
+#if !DO_PROGRESSIVE || DO_ANIMATION
     lerpFac = 0;
 #endif
-    int rayCount = 0;
-    uint32_t state = (data.frameCount * 26699) | 1;
+    const WorkList& work = *data.work;
+
+    // pixels outside the work list keep whatever the backbuffer had
+    for (int i = 0, rIdx = 0; i < work.numPixels; i++)
+    {
+        const int p = work.pixels[i];
+        const int count = WorkListPixelRays(work, i);
+        f3 col(0, 0, 0);
+        for (int s = 0; s < count; s++, ++rIdx)
+        {
+            col += LoadSample(data.samples[rIdx]).color;
+        }
+        col *= 1.0f / float(count);
+
+        if (data.pixelStats)
+        {
+            // Welford update with this frame's estimate of the pixel
+            PixelStats& st = data.pixelStats[p];
+            float lum = 0.2126f * col.x + 0.7152f * col.y + 0.0722f * col.z;
+            float delta = lum - st.mean;
+            st.mean += delta / float(data.frameCount + 1);
+            st.m2 += delta * (lum - st.mean);
+        }
 
+        float* backbuffer = data.backbuffer + p * kBackbufferChannels;
+        f3 prev(backbuffer[0], backbuffer[1], backbuffer[2]);
+        col = prev * lerpFac + col * (1 - lerpFac);
+        backbuffer[0] = col.x;
+        backbuffer[1] = col.y;
+        backbuffer[2] = col.z;
+    }
+}
+
+// generates the camera rays of a frame and traces them through all bounces,
+// leaving the final colors in data.samples
+static void TraceFrame(const RendererData* data, int* outRayCount)
+{
+    int rayCount = 0;
+    uint32_t state = (data->frameCount * 26699) | 1;
+    PerfReading mark;
+    StartStages(mark);
 
-    // generate camera rays for all samples
-    for (int y = 0, rIdx = 0; y < data.screenHeight; y++)
+    if (data->views != NULL)
     {
-        for (int x = 0; x < data.screenWidth; x++)
+        // each view writes its rays to its own range of the wavefront
+        for (int v = 0; v < data->numViews; v++)
         {
-            for (int s = 0; s < DO_SAMPLES_PER_PIXEL; s++, ++rIdx)
-            {
-                float u = float(x + RandomFloat01(state)) * invWidth;
-                float v = float(y + RandomFloat01(state)) * invHeight;
-                data.rays[rIdx] = data.cam->GetRay(u, v, state);
-            }
+            const BatchView& view = data->views[v];
+            RendererData slice = *data;
+            slice.cam = const_cast<Camera*>(&view.cam);
+            slice.work = &view.work;
+            slice.screenWidth = view.screenWidth;
+            slice.screenHeight = view.screenHeight;
+            slice.rays = data->rays + view.firstRay;
+            GenerateCameraRays(slice, state);
         }
     }
+    else
+        GenerateCameraRays(*data, state);
+    CountStage(*data, kStageCameraRays, 0, mark);
+    TraceIterative(*data, rayCount, state);
 
-    // trace all samples through the scene
-    TraceIterative(data, rayCount, state);
+    *outRayCount = rayCount;
+}
+
+// Relative error of the accumulated image: RMS standard error of the pixel means
+// over the mean image luminance. Needs the per pixel statistics.
+static double EstimateRelError(const RendererData& data, int frames)
+{
+    if (frames < 2)
+        return 1.0;
+    const int numPixels = data.work->numPixels;
+    double sumVar = 0, sumMean = 0;
+    for (int i = 0; i < numPixels; i++)
+    {
+        const PixelStats& st = data.pixelStats[data.work->pixels[i]];
+        sumVar += st.m2;
+        sumMean += st.mean;
+    }
+    // m2 / (n - 1) is the per frame variance, the mean of n frames has 1/n of it
+    double meanVar = sumVar / (double(frames - 1) * frames * numPixels);
+    double meanLum = sumMean / numPixels;
+    return meanLum > 0 ? sqrt(meanVar) / meanLum : 1.0;
+}
 
-    // compute cumulated color for all samples
-    for (int y = 0, rIdx = 0; y < data.screenHeight; y++)
+// Decides between frames whether another one fits the termination policies.
+// The time budget predicts the end of the new frame from the average frame time
+// so far, counting frames that are still in flight.
+static bool StartAnotherFrame(const RenderOptions& options, int framesStarted, int framesDone, double elapsed, double relError)
+{
+    int maxFrames = options.maxFrames;
+    if (maxFrames <= 0 && options.timeBudget <= 0 && options.targetRelError <= 0)
+        maxFrames = kNumFrames;
+    if (maxFrames > 0 && framesStarted >= maxFrames)
+        return false;
+    if (framesDone == 0)
+        return true;
+    if (options.timeBudget > 0)
     {
-        for (int x = 0; x < data.screenWidth; x++)
+        double frameTime = elapsed / framesDone;
+        if (elapsed + (framesStarted - framesDone + 1) * frameTime > options.timeBudget)
+            return false;
+    }
+    if (options.targetRelError > 0 && framesDone >= kMinErrorFrames && relError <= options.targetRelError)
+        return false;
+    return true;
+}
+
+static int TracePixels(RendererData data)
+{
+    int rayCount;
+    TraceFrame(&data, &rayCount);
+    PerfReading mark;
+    StartStages(mark);
+    AccumulateSamples(data);
+    CountStage(data, kStageAccumulate, 0, mark);
+    return rayCount;
+}
+
+// rebuilds the light tree from the emissive spheres; empty without DO_LIGHT_SAMPLING
+static void BuildSphereLights(const Scene& scene, LightTree& lights)
+{
+    float power[kSphereCount];
+    for (int i = 0; i < kSphereCount; i++)
+    {
+        const f3& e = scene.mats[i].emissive;
+        float radius = scene.spheres[i].radius;
+        power[i] = DO_LIGHT_SAMPLING ? (0.2126f * e.x + 0.7152f * e.y + 0.0722f * e.z) * radius * radius : 0.0f;
+    }
+    lights.Build(scene.spheres, power, kSphereCount);
+}
+
+// opens the RenderOptions textures; returns NULL when there are none to use
+static SceneTextures* LoadSceneTextures(const RenderOptions& options)
+{
+    if (options.textureCount <= 0)
+        return NULL;
+    SceneTextures* tex = new SceneTextures();
+    tex->cache = CreateTextureCache(size_t(options.textureCacheMB) * 1024 * 1024);
+    tex->count = std::min(options.textureCount, kMaxTextures);
+    if (options.textureCount > kMaxTextures)
+        printf("only the first %d textures are used\n", kMaxTextures);
+    for (int i = 0; i < tex->count; i++)
+        tex->ids[i] = OpenTexture(tex->cache, options.textures[i]);
+    return tex;
+}
+
+static void FreeSceneTextures(SceneTextures* tex)
+{
+    if (tex == NULL)
+        return;
+    PrintTextureCacheStats(tex->cache);
+    DestroyTextureCache(tex->cache);
+    delete tex;
+}
+
+// needs data.env, data.lights, data.textures, data.guide and data.radianceCache
+// set, they decide which light sampling, ray cone, guiding and cache arrays exist
+// the arrays sized by the number of rays, which is all that changes when the
+// wavefront grows
+static void AllocWavefrontArrays(RendererData& data, int numRays)
+{
+    data.numRays = data.maxRays = numRays;
+#if DO_CUDA_RENDER
+    cudaMallocHost((void**)&data.rays, numRays * sizeof(Ray));
+    cudaMallocHost((void**)&data.hits, numRays * sizeof(Hit));
+#else
+    data.rays = AllocLargeArray<WaveRay>(numRays, kShadeChunk);
+    data.hits = AllocLargeArray<WaveHit>(numRays, kShadeChunk);
+#endif
+    data.samples = AllocLargeArray<WaveSample>(numRays, kShadeChunk);
+    data.sIndices = AllocLargeArray<int>(numRays, kShadeChunk);
+    data.alive = AllocLargeArray<uint8_t>(numRays, kShadeChunk);
+#if DO_CUDA_RENDER
+    cudaMallocHost((void**)&data.raysScratch, numRays * sizeof(Ray));
+#else
+    data.raysScratch = AllocLargeArray<WaveRay>(numRays, kShadeChunk);
+#endif
+    data.sIndicesScratch = AllocLargeArray<int>(numRays, kShadeChunk);
+    data.shadowRays = NULL;
+    data.shadowAlive = NULL;
+    data.shadowContrib = NULL;
+    data.shadowTarget = NULL;
+    data.misPdf = NULL;
+    data.misPos = NULL;
+    data.misNormal = NULL;
+    const bool sampleEnv = DO_ENV_SAMPLING && data.env != NULL && data.env->canSample;
+    const bool sampleSpheres = DO_LIGHT_SAMPLING && !data.lights->Empty();
+    if (sampleEnv || sampleSpheres)
+    {
+        data.shadowRays = AllocLargeArray<WaveRay>(numRays, kShadeChunk);
+        data.shadowAlive = AllocLargeArray<uint8_t>(numRays, kShadeChunk);
+        data.shadowContrib = AllocLargeArray<f3>(numRays, kShadeChunk);
+        data.shadowTarget = AllocLargeArray<int>(numRays, kShadeChunk);
+        data.misPdf = AllocLargeArray<float>(numRays, kShadeChunk);
+    }
+    if (sampleSpheres)
+    {
+        data.misPos = AllocLargeArray<f3>(numRays, kShadeChunk);
+        data.misNormal = AllocLargeArray<f3>(numRays, kShadeChunk);
+    }
+    data.coneWidth = NULL;
+    data.coneSpread = NULL;
+    if (data.textures != NULL)
+    {
+        data.coneWidth = AllocLargeArray<float>(numRays, kShadeChunk);
+        data.coneSpread = AllocLargeArray<float>(numRays, kShadeChunk);
+    }
+    data.guideVertices = NULL;
+    data.guideCount = NULL;
+    if (data.guide != NULL)
+    {
+        data.guideVertices = AllocLargeArray<GuideVertex>(numRays * kGuideVertices, kShadeChunk * kGuideVertices);
+        data.guideCount = AllocLargeArray<uint8_t>(numRays, kShadeChunk);
+    }
+    data.cacheVertices = NULL;
+    data.cacheCount = NULL;
+    if (data.radianceCache != NULL)
+    {
+        data.cacheVertices = AllocLargeArray<CacheVertex>(numRays * kCacheVertices, kShadeChunk * kCacheVertices);
+        data.cacheCount = AllocLargeArray<uint8_t>(numRays, kShadeChunk);
+    }
+#if DO_RAY_REORDER
+    AllocReorderBuffers(data.reorder, numRays);
+#endif // DO_RAY_REORDER
+}
+
+static void AllocWavefront(RendererData& data, int numRays, const RenderOptions& options)
+{
+    AllocWavefrontArrays(data, numRays);
+    data.firstHits = NULL;
+    data.pixelStats = NULL;
+    data.views = NULL;
+    data.numViews = 0;
+    data.sampleViews = NULL;
+    data.bounceDone = NULL;
+    data.bounceUser = NULL;
+#if DO_RAY_REORDER
+    data.profile = new ReorderProfile();
+#endif // DO_RAY_REORDER
+#if DO_PERF_COUNTERS
+    data.perf = new PerfProfile();
+#endif // DO_PERF_COUNTERS
+
+    data.backend = CreateIntersectBackend(options.backend);
+    if (data.backend == NULL)
+    {
+        printf("intersection backend %d isn't available in this build, using the cpu one\n", options.backend);
+        data.backend = CreateIntersectBackend(kBackendCpu);
+    }
+    int batchSize = options.batchSize > 0 ? std::min(options.batchSize, numRays) : numRays;
+    data.backend->InitScene(data.scene->spheres, kSphereCount, data.scene->prims, batchSize);
+}
+
+static void FreeWavefrontArrays(RendererData& data)
+{
+#if DO_CUDA_RENDER
+    cudaFreeHost(data.rays);
+    cudaFreeHost(data.hits);
+    cudaFreeHost(data.raysScratch);
+#else
+    FreeLargeArray(data.rays, data.maxRays);
+    FreeLargeArray(data.hits, data.maxRays);
+    FreeLargeArray(data.raysScratch, data.maxRays);
+#endif
+    FreeLargeArray(data.samples, data.maxRays);
+    FreeLargeArray(data.sIndices, data.maxRays);
+    FreeLargeArray(data.alive, data.maxRays);
+    FreeLargeArray(data.sIndicesScratch, data.maxRays);
+    FreeLargeArray(data.shadowRays, data.maxRays);
+    FreeLargeArray(data.shadowAlive, data.maxRays);
+    FreeLargeArray(data.shadowContrib, data.maxRays);
+    FreeLargeArray(data.shadowTarget, data.maxRays);
+    FreeLargeArray(data.misPdf, data.maxRays);
+    FreeLargeArray(data.misPos, data.maxRays);
+    FreeLargeArray(data.misNormal, data.maxRays);
+    FreeLargeArray(data.coneWidth, data.maxRays);
+    FreeLargeArray(data.coneSpread, data.maxRays);
+    FreeLargeArray(data.guideVertices, data.maxRays * kGuideVertices);
+    FreeLargeArray(data.guideCount, data.maxRays);
+    FreeLargeArray(data.cacheVertices, data.maxRays * kCacheVertices);
+    FreeLargeArray(data.cacheCount, data.maxRays);
+#if DO_RAY_REORDER
+    FreeReorderBuffers(data.reorder);
+#endif // DO_RAY_REORDER
+}
+
+static void FreeWavefront(RendererData& data)
+{
+    FreeWavefrontArrays(data);
+    delete[] data.firstHits;
+#if DO_RAY_REORDER
+    delete data.profile;
+#endif // DO_RAY_REORDER
+#if DO_PERF_COUNTERS
+    delete data.perf;
+#endif // DO_PERF_COUNTERS
+
+    data.backend->Free();
+    delete data.backend;
+}
+
+#if DO_RAY_REORDER
+static void PrintReorderProfile(const RendererData* slots)
+{
+    ReorderProfile p = {};
+    for (int i = 0; i < kFramesInFlight; i++)
+    {
+        for (int d = 0; d <= kMaxDepth; d++)
         {
-            f3 col(0, 0, 0);
-            for (int s = 0; s < DO_SAMPLES_PER_PIXEL; s++, ++rIdx)
+            for (int r = 0; r < 2; r++)
             {
-                col += data.samples[rIdx].color;
+                p.traceTime[r][d] += slots[i].profile->traceTime[r][d];
+                p.rays[r][d] += slots[i].profile->rays[r][d];
             }
-            col *= 1.0f / float(DO_SAMPLES_PER_PIXEL);
-
-            f3 prev(backbuffer[0], backbuffer[1], backbuffer[2]);
-            col = prev * lerpFac + col * (1 - lerpFac);
-            backbuffer[0] = col.x;
-            backbuffer[1] = col.y;
-            backbuffer[2] = col.z;
-            backbuffer += 4;
+            p.sortTime[d] += slots[i].profile->sortTime[d];
         }
     }
 
-    return rayCount;
+    printf("ray reordering, ns per ray:\n");
+    printf("depth      rays    trace  sorted-trace     sort   net gain\n");
+    for (int d = 0; d <= kMaxDepth; d++)
+    {
+        if (p.rays[0][d] + p.rays[1][d] == 0)
+            continue;
+        double unsorted = p.rays[0][d] > 0 ? p.traceTime[0][d] * 1.0e9 / p.rays[0][d] : 0;
+        double sorted = p.rays[1][d] > 0 ? p.traceTime[1][d] * 1.0e9 / p.rays[1][d] : 0;
+        double sort = p.rays[1][d] > 0 ? p.sortTime[d] * 1.0e9 / p.rays[1][d] : 0;
+        if (p.rays[0][d] > 0 && p.rays[1][d] > 0)
+            printf("%5d %9.0f %8.1f %13.1f %8.1f %10.1f\n", d, p.rays[0][d] + p.rays[1][d], unsorted, sorted, sort, unsorted - sorted - sort);
+        else
+            printf("%5d %9.0f %8.1f %13.1f %8.1f          -\n", d, p.rays[0][d] + p.rays[1][d], unsorted, sorted, sort);
+    }
 }
+#endif // DO_RAY_REORDER
 
-void Render(int screenWidth, int screenHeight, float* backbuffer, int& outRayCount)
+#if DO_PERF_COUNTERS
+static void PrintPerfRow(const char* label, const PerfCounts& c, double rays)
 {
-    f3 lookfrom(0, 2, 3);
-    f3 lookat(0, 0, 0);
-    float distToFocus = 3;
+    printf("%-12s", label);
+    for (int e = 0; e < kPerfEventCount; e++)
+    {
+        if (PerfEventAvailable(e))
+            printf(" %13.2f", c.value[e] / rays);
+        else
+            printf(" %13s", "-");
+    }
+    if (PerfEventAvailable(kPerfCycles) && PerfEventAvailable(kPerfInstructions) && c.value[kPerfCycles] > 0)
+        printf(" %5.2f", double(c.value[kPerfInstructions]) / c.value[kPerfCycles]);
+    printf("\n");
+}
+
+static void PrintPerfHeader(const char* label)
+{
+    printf("%-12s", label);
+    for (int e = 0; e < kPerfEventCount; e++)
+        printf(" %13s", PerfEventName(e));
+    printf("   IPC\n");
+}
+
+// events per traced ray, i.e. millions per Mray: per stage over the whole
+// render, then per bounce
+static void PrintPerfProfile(const RendererData* slots)
+{
+    bool any = false;
+    for (int e = 0; e < kPerfEventCount; e++)
+        any |= PerfEventAvailable(e);
+    if (!any)
+    {
+        printf("hardware performance counters unavailable (no perf_event_open, or perf_event_paranoid too high)\n");
+        return;
+    }
+
+    const PerfProfile& p = *slots[0].perf;
+    double totalRays = 0;
+    for (int d = 0; d <= kMaxDepth; d++)
+        totalRays += p.rays[d];
+    if (totalRays == 0)
+        return;
+
+    printf("hardware counters per ray over %.1f Mrays:\n", totalRays * 1.0e-6);
+    PrintPerfHeader("stage");
+    for (int s = 0; s < kStageCount; s++)
+    {
+        PerfCounts sum = {};
+        for (int d = 0; d <= kMaxDepth; d++)
+            for (int e = 0; e < kPerfEventCount; e++)
+                sum.value[e] += p.counts[s][d].value[e];
+        PrintPerfRow(s_StageNames[s], sum, totalRays);
+    }
+
+    // each bounce against the rays it traced
+    PrintPerfHeader("bounce");
+    for (int d = 0; d <= kMaxDepth; d++)
+    {
+        if (p.rays[d] == 0)
+            continue;
+        PerfCounts sum = {};
+        for (int s = kStageTrace; s <= kStageCompact; s++)
+            for (int e = 0; e < kPerfEventCount; e++)
+                sum.value[e] += p.counts[s][d].value[e];
+        char label[32];
+        snprintf(label, sizeof(label), "%d (%.1fM)", d, p.rays[d] * 1.0e-6);
+        PrintPerfRow(label, sum, p.rays[d]);
+    }
+}
+#endif // DO_PERF_COUNTERS
+
+CameraView DefaultCameraView()
+{
+    CameraView view =
+    {
+        { 0, 2, 3 },
+        { 0, 0, 0 },
+        60,
 #if DO_MITSUBA_COMPARE
-    float aperture = 0.0f;
+        0.0f,
 #else
-    float aperture = 0.1f;
+        0.1f,
 #endif
+        3,
+    };
+    return view;
+}
 
-    for (int i = 0; i < kSphereCount; ++i)
-        s_Spheres[i].UpdateDerivedData();
-
-    s_Cam = Camera(lookfrom, lookat, f3(0, 1, 0), 60, float(screenWidth) / float(screenHeight), aperture, distToFocus);
-
-    // let's allocate a few arrays needed by the renderer
-    int numRays = screenWidth * screenHeight * DO_SAMPLES_PER_PIXEL;
-    Ray* rays = NULL;
-    Hit* hits = NULL;
-#if DO_CUDA_RENDER
-    cudaMallocHost((void**)&rays, numRays * sizeof(Ray));
-    cudaMallocHost((void**)&hits, numRays * sizeof(Hit));
-#else
-    rays = new Ray[numRays];
-    hits = new Hit[numRays];
-#endif
-
-    Sample* samples = new Sample[numRays];
-
-    RendererData args;
-    args.screenWidth = screenWidth;
-    args.screenHeight = screenHeight;
-    args.backbuffer = backbuffer;
-    args.cam = &s_Cam;
-    args.rays = rays;
-    args.samples = samples;
-    args.hits = hits;
-    args.numRays = numRays;
-
-#if DO_CUDA_RENDER
-    initDeviceData(s_Spheres, kSphereCount, numRays, args.deviceData);
-#endif // DO_CUDA_RENDER
+static Camera MakeCamera(const CameraView& view, float aspect)
+{
+    f3 lookfrom(view.lookFrom[0], view.lookFrom[1], view.lookFrom[2]);
+    f3 lookat(view.lookAt[0], view.lookAt[1], view.lookAt[2]);
+    return Camera(lookfrom, lookat, f3(0, 1, 0), view.vfov, aspect, view.aperture, view.focusDist);
+}
+
+// What every way of rendering sets up around its wavefront: the built-in scene
+// with its lights, the environment and textures named by the options, and the
+// path guide and radiance cache when they're enabled. The guide and the cache
+// keep learning over all the frames rendered with one setup, which is only
+// right while those frames show the same static scene; learn turns them off
+// when they don't.
+struct SceneSetup
+{
+    Scene scene;
+    EnvMap env;
+    bool hasEnv;
+    LightTree lights;
+    SceneTextures* textures;
+    PathGuide* guide;
+    RadianceCache* radianceCache;
+};
+
+static void LoadSceneSetup(SceneSetup& setup, const RenderOptions& options, bool learn)
+{
+    LoadDefaultScene(setup.scene);
+    setup.hasEnv = options.envMap != NULL && LoadEnvMap(options.envMap, setup.env);
+    BuildSphereLights(setup.scene, setup.lights);
+    setup.textures = LoadSceneTextures(options);
+    setup.guide = DO_PATH_GUIDING && learn ? CreatePathGuide() : NULL;
+    setup.radianceCache = options.radianceCacheDepth > 0 && learn ? CreateRadianceCache() : NULL;
+}
+
+static void FreeSceneSetup(SceneSetup& setup)
+{
+    if (setup.hasEnv)
+        FreeEnvMap(setup.env);
+    FreeSceneTextures(setup.textures);
+    if (setup.guide)
+        DestroyPathGuide(setup.guide);
+    if (setup.radianceCache)
+        DestroyRadianceCache(setup.radianceCache);
+}
+
+// points data at the setup and allocates its wavefront; the caller fills in the
+// screen size, camera, work list and backbuffer
+static void InitRendererData(RendererData& data, SceneSetup& setup, int maxRays, const RenderOptions& options)
+{
+    data.backbuffer = NULL;
+    data.scene = &setup.scene;
+    data.env = setup.hasEnv ? &setup.env : NULL;
+    data.lights = &setup.lights;
+    data.textures = setup.textures;
+    data.guide = setup.guide;
+    data.radianceCache = setup.radianceCache;
+    data.cacheDepth = options.radianceCacheDepth;
+    AllocWavefront(data, maxRays, options);
+}
+
+void Render(int screenWidth, int screenHeight, float* backbuffer, int& outRayCount, const RenderOptions& options)
+{
+    Camera cam = MakeCamera(DefaultCameraView(), float(screenWidth) / float(screenHeight));
 
-    for (int frame = 0; frame < kNumFrames; frame++)
+    WorkList work;
+    BuildWorkList(work, screenWidth, screenHeight, options.region, DO_SAMPLES_PER_PIXEL);
+    if (work.numRays == 0)
     {
-        args.frameCount = frame;
-        outRayCount += TracePixels(args);
+        printf("nothing to render, the crop window or importance map is empty\n");
+        FreeWorkList(work);
+        return;
     }
-
-#if DO_CUDA_RENDER
-    cudaFreeHost(rays);
-    cudaFreeHost(hits);
-#else
-    delete[] rays;
-    delete[] hits;
-#endif
-    delete[] samples;
-
-#if DO_CUDA_RENDER
-    freeDeviceData(args.deviceData);
-#endif // DO_CUDA_RENDER
 
+    // each frame samples what the frames before it learned, so they have to
+    // finish first
+    SceneSetup setup;
+    LoadSceneSetup(setup, options, !DO_PIPELINED_FRAMES && !DO_ANIMATION);
+
+    // let's allocate a few arrays needed by the renderer, one set per frame in flight
+    RendererData slots[kFramesInFlight];
+    for (int i = 0; i < kFramesInFlight; i++)
+    {
+        RendererData& args = slots[i];
+        args.screenWidth = screenWidth;
+        args.screenHeight = screenHeight;
+        args.cam = &cam;
+        args.work = &work;
+        InitRendererData(args, setup, work.numRays, options);
+        args.backbuffer = backbuffer;
+    }
+
+    // accumulation is serialized, so all slots share one set of pixel statistics
+    PixelStats* pixelStats = NULL;
+    if (options.targetRelError > 0)
+    {
+        pixelStats = new PixelStats[screenWidth * screenHeight];
+        memset(pixelStats, 0, screenWidth * screenHeight * sizeof(pixelStats[0]));
+        for (int i = 0; i < kFramesInFlight; i++)
+            slots[i].pixelStats = pixelStats;
+    }
+
+    const double startTime = NowSeconds();
+    double relError = 1.0;
+    int framesDone = 0;
+
+#if DO_PIPELINED_FRAMES
+    // frame N+1 generates its camera rays and traces its first bounces while
+    // frame N is still in its deep bounces. Frames are accumulated in order, so
+    // the progressive blend sees exactly the same sequence as the serial loop.
+    // When the policies say stop, the frames already in flight still finish and
+    // get accumulated.
+    std::thread inflight[kFramesInFlight];
+    int rayCounts[kFramesInFlight];
+    int framesStarted = 0;
+    for (;;)
+    {
+        const int slot = framesStarted % kFramesInFlight;
+        if (inflight[slot].joinable())
+        {
+            inflight[slot].join();
+            AccumulateSamples(slots[slot]);
+            outRayCount += rayCounts[slot];
+            if (options.frameDone != NULL)
+                options.frameDone(options.frameUser, framesDone, backbuffer);
+            framesDone++;
+            if (pixelStats)
+                relError = EstimateRelError(slots[slot], framesDone);
+        }
+        if (!StartAnotherFrame(options, framesStarted, framesDone, NowSeconds() - startTime, relError))
+            break;
+        slots[slot].frameCount = framesStarted;
+        inflight[slot] = std::thread(TraceFrame, &slots[slot], &rayCounts[slot]);
+        framesStarted++;
+    }
+    for (; framesDone < framesStarted; framesDone++)
+    {
+        const int slot = framesDone % kFramesInFlight;
+        inflight[slot].join();
+        AccumulateSamples(slots[slot]);
+        outRayCount += rayCounts[slot];
+        if (options.frameDone != NULL)
+            options.frameDone(options.frameUser, framesDone, backbuffer);
+    }
+    if (pixelStats)
+        relError = EstimateRelError(slots[0], framesDone);
+#else
+    for (int frame = 0; StartAnotherFrame(options, frame, frame, NowSeconds() - startTime, relError); frame++)
+    {
+#if DO_ANIMATION
+        int dirty[kSphereCount];
+        int numDirty = AnimateSpheres(s_SphereTracks, kSphereTrackCount, frame * kAnimationFrameTime, setup.scene.spheres, dirty);
+        if (numDirty > 0)
+        {
+            slots[0].backend->UpdateSpheres(setup.scene.spheres, dirty, numDirty);
+            BuildSphereLights(setup.scene, setup.lights);
+        }
+#endif // DO_ANIMATION
+        slots[0].frameCount = frame;
+        outRayCount += TracePixels(slots[0]);
+        if (setup.guide)
+            UpdatePathGuide(setup.guide);
+        if (setup.radianceCache)
+            UpdateRadianceCache(setup.radianceCache);
+        if (options.frameDone != NULL)
+            options.frameDone(options.frameUser, frame, backbuffer);
+        framesDone++;
+        if (pixelStats)
+            relError = EstimateRelError(slots[0], framesDone);
+    }
+#endif // DO_PIPELINED_FRAMES
+
+    if (options.timeBudget > 0 || options.targetRelError > 0)
+    {
+        printf("stopped after %d frames in %.2fs", framesDone, NowSeconds() - startTime);
+        if (pixelStats)
+            printf(", estimated relative error %.2f%%", relError * 100.0);
+        printf("\n");
+    }
+    delete[] pixelStats;
+
+#if DO_RAY_REORDER
+    PrintReorderProfile(slots);
+#endif // DO_RAY_REORDER
+#if DO_PERF_COUNTERS
+    PrintPerfProfile(slots);
+#endif // DO_PERF_COUNTERS
+
+    for (int i = 0; i < kFramesInFlight; i++)
+    {
+        slots[i].backend->PrintStats();
+        FreeWavefront(slots[i]);
+    }
+    FreeWorkList(work);
+    if (setup.guide)
+        PrintPathGuideStats(setup.guide);
+    if (setup.radianceCache)
+        PrintRadianceCacheStats(setup.radianceCache);
+    FreeSceneSetup(setup);
+    PrintLargeMemoryStats();
+}
+
+// averages the samples of every pixel and picks the first hit of its first sample
+static void GatherPixels(const RendererData& data, f3* colors, FirstHit* firstHits)
+{
+    const WorkList& work = *data.work;
+    ParallelFor(work.numPixels, kShadeChunk / DO_SAMPLES_PER_PIXEL, [&](int chunk, int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            const int first = work.pixelFirstRay[i], count = WorkListPixelRays(work, i);
+            f3 col(0, 0, 0);
+            for (int s = 0; s < count; s++)
+                col += LoadSample(data.samples[first + s]).color;
+            colors[work.pixels[i]] = col * (1.0f / float(count));
+            firstHits[work.pixels[i]] = data.firstHits[first];
+        }
+    });
+}
+
+void RenderInteractive(int screenWidth, int screenHeight, float* backbuffer, int& outRayCount, const InteractiveSession& session, const RenderOptions& options)
+{
+    SceneSetup setup;
+    LoadSceneSetup(setup, options, true);
+    Camera cam;
+
+    const float aspect = float(screenWidth) / float(screenHeight);
+    const int maxRays = screenWidth * screenHeight * DO_SAMPLES_PER_PIXEL;
+    // always the full internal frame, rebuilt when the resolution scale changes
+    WorkList work = {};
+    WorkRegion fullFrame = {};
+    int workWidth = 0, workHeight = 0;
+    RendererData data;
+    data.cam = &cam;
+    data.work = &work;
+    InitRendererData(data, setup, maxRays, options);
+    data.firstHits = new FirstHit[maxRays];
+
+    f3* colors = new f3[screenWidth * screenHeight];
+    FirstHit* pixelHits = new FirstHit[screenWidth * screenHeight];
+    TemporalHistory hist;
+    AllocTemporalHistory(hist, screenWidth, screenHeight);
+
+    float scale = 1.0f;
+    CameraView view = DefaultCameraView(), prevView;
+    for (int frame = 0; session.updateCamera(session.user, frame, view); frame++)
+    {
+        double t0 = NowSeconds();
+        const bool moved = frame == 0 || memcmp(&view, &prevView, sizeof(view)) != 0;
+        cam = MakeCamera(view, aspect);
+
+        data.frameCount = frame;
+        data.screenWidth = std::max(1, int(screenWidth * scale));
+        data.screenHeight = std::max(1, int(screenHeight * scale));
+        if (data.screenWidth != workWidth || data.screenHeight != workHeight)
+        {
+            FreeWorkList(work);
+            BuildWorkList(work, data.screenWidth, data.screenHeight, fullFrame, DO_SAMPLES_PER_PIXEL);
+            workWidth = data.screenWidth;
+            workHeight = data.screenHeight;
+        }
+        data.numRays = work.numRays;
+
+        int rayCount;
+        TraceFrame(&data, &rayCount);
+        outRayCount += rayCount;
+        if (data.guide)
+            UpdatePathGuide(data.guide);
+        if (data.radianceCache)
+            UpdateRadianceCache(data.radianceCache);
+
+        GatherPixels(data, colors, pixelHits);
+        ResolveTemporal(hist, colors, pixelHits, data.screenWidth, data.screenHeight, cam, moved, backbuffer, kBackbufferChannels);
+
+        float frameMs = float(NowSeconds() - t0) * 1000.0f;
+        if (session.frameDone != NULL)
+            session.frameDone(session.user, frame, frameMs, scale);
+
+        // the cost follows the pixel count, i.e. the square of the scale; change
+        // it in small steps so a single slow frame doesn't make the image jump
+        float step = sqrtf(session.targetFrameMs / std::max(frameMs, 0.01f));
+        scale = std::min(1.0f, std::max(kMinResolutionScale, scale * std::min(1.1f, std::max(0.8f, step))));
+        prevView = view;
+    }
+
+    FreeTemporalHistory(hist);
+    FreeWorkList(work);
+    delete[] colors;
+    delete[] pixelHits;
+    FreeWavefront(data);
+    FreeSceneSetup(setup);
+}
+
+struct RenderContext
+{
+    int screenWidth, screenHeight;
+    SceneSetup setup;
+    Camera cam;
+    WorkList work;
+    RendererData data;
+};
+
+RenderContext* CreateRenderContext(int screenWidth, int screenHeight, const RenderOptions& options)
+{
+    RenderContext* ctx = new RenderContext();
+    ctx->screenWidth = screenWidth;
+    ctx->screenHeight = screenHeight;
+    LoadSceneSetup(ctx->setup, options, true);
+    // always the full frame; crop windows and importance maps are for single renders
+    WorkRegion fullFrame = {};
+    BuildWorkList(ctx->work, screenWidth, screenHeight, fullFrame, DO_SAMPLES_PER_PIXEL);
+
+    RendererData& data = ctx->data;
+    data.screenWidth = screenWidth;
+    data.screenHeight = screenHeight;
+    data.cam = &ctx->cam;
+    data.work = &ctx->work;
+    InitRendererData(data, ctx->setup, ctx->work.numRays, options);
+    return ctx;
+}
+
+void DestroyRenderContext(RenderContext* ctx)
+{
+    FreeWavefront(ctx->data);
+    FreeSceneSetup(ctx->setup);
+    FreeWorkList(ctx->work);
+    delete ctx;
+}
+
+void ResizeRenderContext(RenderContext* ctx, int screenWidth, int screenHeight)
+{
+    RendererData& data = ctx->data;
+    FreeWorkList(ctx->work);
+    WorkRegion fullFrame = {};
+    BuildWorkList(ctx->work, screenWidth, screenHeight, fullFrame, DO_SAMPLES_PER_PIXEL);
+    // the backend keeps its scene and batch size, it traces more rays in more batches
+    if (ctx->work.numRays > data.maxRays)
+    {
+        FreeWavefrontArrays(data);
+        AllocWavefrontArrays(data, ctx->work.numRays);
+    }
+    ctx->screenWidth = data.screenWidth = screenWidth;
+    ctx->screenHeight = data.screenHeight = screenHeight;
+    data.numRays = ctx->work.numRays;
+}
+
+int RenderContextJob(RenderContext* ctx, const RenderJob& job, float* backbuffer)
+{
+    RendererData& data = ctx->data;
+    ctx->cam = MakeCamera(job.view, float(ctx->screenWidth) / float(ctx->screenHeight));
+    data.backbuffer = backbuffer;
+    data.bounceDone = job.bounceDone;
+    data.bounceUser = job.user;
+    int rayCount = 0;
+    for (int frame = 0; frame < job.frames; frame++)
+    {
+        // frame 0 overwrites whatever the backbuffer held before
+        data.frameCount = job.firstFrame + frame;
+        rayCount += TracePixels(data);
+        if (data.guide)
+            UpdatePathGuide(data.guide);
+        if (data.radianceCache)
+            UpdateRadianceCache(data.radianceCache);
+        if (job.progress != NULL && !job.progress(job.user, frame + 1, job.frames))
+            break;
+    }
+    data.backbuffer = NULL;
+    data.bounceDone = NULL;
+    return rayCount;
+}
+
+void RenderViews(const RenderView* views, int numViews, int& outRayCount, const RenderOptions& options)
+{
+    BatchView* batch = new BatchView[numViews];
+    int numRays = 0;
+    for (int v = 0; v < numViews; v++)
+    {
+        BatchView& bv = batch[v];
+        bv.cam = MakeCamera(views[v].camera, float(views[v].width) / float(views[v].height));
+        WorkRegion fullFrame = {};
+        BuildWorkList(bv.work, views[v].width, views[v].height, fullFrame, DO_SAMPLES_PER_PIXEL);
+        bv.backbuffer = views[v].backbuffer;
+        bv.screenWidth = views[v].width;
+        bv.screenHeight = views[v].height;
+        bv.firstRay = numRays;
+        numRays += bv.work.numRays;
+    }
+    if (numRays == 0)
+    {
+        for (int v = 0; v < numViews; v++)
+            FreeWorkList(batch[v].work);
+        delete[] batch;
+        return;
+    }
+
+    SceneSetup setup;
+    LoadSceneSetup(setup, options, true);
+    RendererData data;
+    data.screenWidth = batch[0].screenWidth;
+    data.screenHeight = batch[0].screenHeight;
+    data.cam = &batch[0].cam;
+    data.work = NULL;
+    InitRendererData(data, setup, numRays, options);
+    data.views = batch;
+    data.numViews = numViews;
+    data.sampleViews = AllocLargeArray<uint16_t>(numRays, kShadeChunk);
+    for (int v = 0; v < numViews; v++)
+    {
+        for (int i = 0; i < batch[v].work.numRays; i++)
+            data.sampleViews[batch[v].firstRay + i] = uint16_t(v);
+    }
+
+    // no per pixel statistics for batches, so no error target either
+    RenderOptions policy = options;
+    policy.targetRelError = 0;
+    const double startTime = NowSeconds();
+    int framesDone = 0;
+    for (int frame = 0; StartAnotherFrame(policy, frame, frame, NowSeconds() - startTime, 1.0); frame++)
+    {
+        data.frameCount = frame;
+        int rayCount;
+        TraceFrame(&data, &rayCount);
+        outRayCount += rayCount;
+        for (int v = 0; v < numViews; v++)
+        {
+            RendererData slice = data;
+            slice.work = &batch[v].work;
+            slice.backbuffer = batch[v].backbuffer;
+            slice.samples = data.samples + batch[v].firstRay;
+            AccumulateSamples(slice);
+        }
+        if (data.guide)
+            UpdatePathGuide(data.guide);
+        if (data.radianceCache)
+            UpdateRadianceCache(data.radianceCache);
+        framesDone++;
+    }
+    if (options.timeBudget > 0)
+        printf("stopped after %d frames in %.2fs\n", framesDone, NowSeconds() - startTime);
+
+    data.backend->PrintStats();
+    FreeLargeArray(data.sampleViews, numRays);
+    FreeWavefront(data);
+    FreeSceneSetup(setup);
+    for (int v = 0; v < numViews; v++)
+        FreeWorkList(batch[v].work);
+    delete[] batch;
+}
+
+int WavefrontBytesPerRay()
+{
+    // every bounce writes the ray and its hit once, then shading reads both back,
+    // reads and writes the sample and the sample index, and writes the scattered ray
+    return 3 * sizeof(WaveRay) + 2 * sizeof(WaveHit) + 2 * sizeof(WaveSample) + 3 * sizeof(int);
 }
@@ -1,3 +1,129 @@
 #pragma once
 
-void Render(int screenWidth, int screenHeight, float* backbuffer, int& outRayCount);
+#include "Config.h"
+#include "WorkList.h"
+#include <stddef.h>
+
+enum BackendType
+{
+    kBackendCpu,            // HitWorld on the host, zero copy
+    kBackendEmulatedDevice, // host emulation of the CUDA memory model and copies
+    kBackendCuda,           // CudaRender.cu, needs DO_CUDA_RENDER
+};
+
+struct RenderOptions
+{
+    BackendType backend;
+    int batchSize; // max rays per intersection batch, 0 = whole wavefront
+
+    // Termination policies, checked between frames so the frame in progress
+    // always finishes. Render stops at whichever limit is reached first.
+    int maxFrames;        // 0 = no cap, only valid with a budget or error target
+    float timeBudget;     // wall clock seconds, 0 = off
+    float targetRelError; // estimated relative error of the image, 0 = off
+
+    // crop window and importance map; pixels left out keep their backbuffer contents
+    WorkRegion region;
+
+    // lat-long PFM or Radiance .hdr file lighting the scene, NULL for the built-in sky
+    const char* envMap;
+
+    // tiled .ttex files for the materials' texture slots, read through a cache of
+    // textureCacheMB; NULL or 0 count for untextured materials
+    const char* const* textures;
+    int textureCount;
+    int textureCacheMB;
+
+    // diffuse paths end in a world space radiance cache from this bounce on,
+    // trading a small bias for shorter paths; 0 = off
+    int radianceCacheDepth;
+
+    // optional, Render calls it with the backbuffer every time a frame has been
+    // accumulated into it
+    void (*frameDone)(void* user, int frame, const float* backbuffer);
+    void* frameUser;
+
+    RenderOptions() : backend(DO_CUDA_RENDER ? kBackendCuda : kBackendCpu), batchSize(0), maxFrames(kNumFrames), timeBudget(0), targetRelError(0), region(), envMap(NULL),
+        textures(NULL), textureCount(0), textureCacheMB(64), radianceCacheDepth(0), frameDone(NULL), frameUser(NULL) {}
+};
+
+struct CameraView
+{
+    float lookFrom[3];
+    float lookAt[3];
+    float vfov; // top to bottom in degrees
+    float aperture;
+    float focusDist;
+};
+
+// the view Render uses
+CameraView DefaultCameraView();
+
+void Render(int screenWidth, int screenHeight, float* backbuffer, int& outRayCount, const RenderOptions& options = RenderOptions());
+
+struct InteractiveSession
+{
+    // called before every frame to move the camera; return false to end the session
+    bool (*updateCamera)(void* user, int frame, CameraView& view);
+    // optional, called after every frame with its duration and resolution scale
+    void (*frameDone)(void* user, int frame, float frameMs, float resolutionScale);
+    void* user;
+    float targetFrameMs;
+};
+
+// Renders until updateCamera returns false. Previous frames are reprojected into
+// the current view using first-hit depth, and the internal resolution scales to
+// keep frames close to targetFrameMs.
+void RenderInteractive(int screenWidth, int screenHeight, float* backbuffer, int& outRayCount, const InteractiveSession& session, const RenderOptions& options = RenderOptions());
+
+struct RenderView
+{
+    CameraView camera;
+    int width, height;
+    float* backbuffer; // width * height * kBackbufferChannels floats
+};
+
+// Renders several views of the scene at once (turntables, cube map faces,
+// probes): each frame generates the camera rays of every view into one shared
+// wavefront, so small views fill the intersection batches and the thread pool
+// together instead of each one underfilling the machine. Runs options.maxFrames
+// frames or until options.timeBudget; crop windows, importance maps and the
+// error target don't apply.
+void RenderViews(const RenderView* views, int numViews, int& outRayCount, const RenderOptions& options = RenderOptions());
+
+// A renderer instance: keeps its own copy of the scene, its lights and textures,
+// the camera, the intersection backend with its acceleration structure, and the
+// wavefront buffers alive between renders, so that many short jobs in one
+// process only pay for their frames. Jobs always render the full frame. Separate
+// contexts share no state and may render from several threads at once, see
+// RenderScheduler.h; one context renders one job at a time.
+struct RenderContext;
+
+RenderContext* CreateRenderContext(int screenWidth, int screenHeight, const RenderOptions& options);
+void DestroyRenderContext(RenderContext* ctx);
+// Changes the size jobs render at. The wavefront only grows, and only when the
+// new size needs more rays than any earlier one; the scene, backend, guide and
+// cache stay as they are.
+void ResizeRenderContext(RenderContext* ctx, int screenWidth, int screenHeight);
+
+struct RenderJob
+{
+    CameraView view;
+    int frames; // progressive frames of DO_SAMPLES_PER_PIXEL samples each
+    // frames the backbuffer already holds from earlier jobs with the same view
+    // and size, which the new ones blend with; 0 starts the image over
+    int firstFrame;
+    // optional, called after every frame; return false to stop the job early
+    bool (*progress)(void* user, int framesDone, int frames);
+    // optional, called between the bounces of every frame; may block to let
+    // more urgent work have the thread pool
+    void (*bounceDone)(void* user);
+    void* user;
+};
+
+// renders a job into a screenWidth x screenHeight backbuffer, replacing its
+// contents unless job.firstFrame > 0; returns the number of rays traced
+int RenderContextJob(RenderContext* ctx, const RenderJob& job, float* backbuffer);
+
+// bytes of wavefront records moved per traced ray and bounce
+int WavefrontBytesPerRay();
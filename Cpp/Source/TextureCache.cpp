@@ -0,0 +1,348 @@
+#include "TextureCache.h"
+#include <algorithm>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_WIN32)
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+const size_t kTileBytes = kTextureTileSize * kTextureTileSize * 4;
+
+struct TextureFile
+{
+    FILE* file;
+    TiledTextureHeader header;
+    std::vector<uint64_t> levelOffset; // file offset of each level's first tile
+    std::vector<int> levelWidth, levelHeight, levelTilesX;
+};
+
+// one cached tile, linked into the LRU list; head is the most recently used
+struct CacheSlot
+{
+    uint64_t key;
+    int prev, next;
+};
+
+// Tiles are spread over shards by a hash of their key, each shard with its own
+// lock, LRU list and share of the budget, so lookups from all the shading
+// threads rarely wait on each other. A shard's lock covers its LRU update and
+// copying texels out of its tiles, and on a miss the tile read, which also takes
+// fileMutex since the FILE handles are shared.
+const int kTextureCacheShards = 16;
+
+struct CacheShard
+{
+    std::mutex mutex;
+    std::unordered_map<uint64_t, int> tileSlots;
+    std::vector<CacheSlot> slots;
+    std::vector<int> freeSlots;
+    uint8_t* tileMemory;
+    int head, tail;
+    uint64_t hits, misses, evictions, bytesRead;
+};
+
+struct TextureCache
+{
+    std::mutex fileMutex; // also guards adding textures
+    std::vector<TextureFile> textures;
+    CacheShard shards[kTextureCacheShards];
+};
+
+static int LevelSize(int size, int level)
+{
+    return std::max(1, size >> level);
+}
+
+static int TileCount(int size)
+{
+    return (size + kTextureTileSize - 1) / kTextureTileSize;
+}
+
+bool WriteTiledTexture(const char* path, const uint8_t* rgba, int width, int height)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+
+    int levels = 1;
+    while ((width >> levels) > 0 || (height >> levels) > 0)
+        levels++;
+    TiledTextureHeader header = { { 'T', 'T', 'E', 'X' }, 1, uint32_t(width), uint32_t(height), uint32_t(kTextureTileSize), uint32_t(levels) };
+    fwrite(&header, sizeof(header), 1, f);
+
+    std::vector<uint8_t> level(rgba, rgba + size_t(width) * height * 4), next;
+    std::vector<uint8_t> tile(kTileBytes);
+    for (int l = 0; l < levels; l++)
+    {
+        const int w = LevelSize(width, l), h = LevelSize(height, l);
+        for (int ty = 0; ty < TileCount(h); ty++)
+        {
+            for (int tx = 0; tx < TileCount(w); tx++)
+            {
+                std::fill(tile.begin(), tile.end(), 0);
+                for (int y = 0; y < kTextureTileSize && ty * kTextureTileSize + y < h; y++)
+                {
+                    int x0 = tx * kTextureTileSize;
+                    int count = std::min(kTextureTileSize, w - x0);
+                    memcpy(&tile[y * kTextureTileSize * 4], &level[(size_t(ty * kTextureTileSize + y) * w + x0) * 4], count * 4);
+                }
+                fwrite(tile.data(), 1, kTileBytes, f);
+            }
+        }
+
+        // 2x2 box filter; odd sizes reuse the last row or column
+        const int nw = LevelSize(width, l + 1), nh = LevelSize(height, l + 1);
+        next.resize(size_t(nw) * nh * 4);
+        for (int y = 0; y < nh; y++)
+        {
+            for (int x = 0; x < nw; x++)
+            {
+                int xs[2] = { std::min(2 * x, w - 1), std::min(2 * x + 1, w - 1) };
+                int ys[2] = { std::min(2 * y, h - 1), std::min(2 * y + 1, h - 1) };
+                for (int c = 0; c < 4; c++)
+                {
+                    int sum = 0;
+                    for (int j = 0; j < 2; j++)
+                        for (int i = 0; i < 2; i++)
+                            sum += level[(size_t(ys[j]) * w + xs[i]) * 4 + c];
+                    next[(size_t(y) * nw + x) * 4 + c] = uint8_t((sum + 2) / 4);
+                }
+            }
+        }
+        level.swap(next);
+    }
+    bool ok = ferror(f) == 0;
+    fclose(f);
+    return ok;
+}
+
+TextureCache* CreateTextureCache(size_t budgetBytes)
+{
+    TextureCache* cache = new TextureCache();
+    // a bilinear lookup copies each texel out right away, so even one tile a
+    // shard works
+    int numSlots = int(std::max<size_t>(1, budgetBytes / kTileBytes / kTextureCacheShards));
+    for (int s = 0; s < kTextureCacheShards; s++)
+    {
+        CacheShard& shard = cache->shards[s];
+        shard.slots.resize(numSlots);
+        shard.freeSlots.resize(numSlots);
+        for (int i = 0; i < numSlots; i++)
+            shard.freeSlots[i] = numSlots - 1 - i;
+        shard.tileMemory = new uint8_t[numSlots * kTileBytes];
+        shard.head = shard.tail = -1;
+        shard.hits = shard.misses = shard.evictions = shard.bytesRead = 0;
+    }
+    return cache;
+}
+
+void DestroyTextureCache(TextureCache* cache)
+{
+    for (size_t i = 0; i < cache->textures.size(); i++)
+        fclose(cache->textures[i].file);
+    for (int s = 0; s < kTextureCacheShards; s++)
+        delete[] cache->shards[s].tileMemory;
+    delete cache;
+}
+
+int OpenTexture(TextureCache* cache, const char* path)
+{
+    TextureFile tex;
+    tex.file = fopen(path, "rb");
+    if (tex.file == NULL)
+    {
+        printf("can't open texture %s\n", path);
+        return 0;
+    }
+    const TiledTextureHeader& h = tex.header;
+    if (fread(&tex.header, sizeof(tex.header), 1, tex.file) != 1 || memcmp(h.magic, "TTEX", 4) != 0 ||
+        h.version != 1 || h.tileSize != kTextureTileSize || h.width == 0 || h.height == 0 || h.levels == 0 || h.levels > 32)
+    {
+        printf("texture %s isn't a tiled texture with %d texel tiles\n", path, kTextureTileSize);
+        fclose(tex.file);
+        return 0;
+    }
+
+    uint64_t offset = sizeof(TiledTextureHeader);
+    for (uint32_t l = 0; l < h.levels; l++)
+    {
+        int w = LevelSize(h.width, l), hh = LevelSize(h.height, l);
+        tex.levelOffset.push_back(offset);
+        tex.levelWidth.push_back(w);
+        tex.levelHeight.push_back(hh);
+        tex.levelTilesX.push_back(TileCount(w));
+        offset += uint64_t(TileCount(w)) * TileCount(hh) * kTileBytes;
+    }
+
+    std::lock_guard<std::mutex> lock(cache->fileMutex);
+    cache->textures.push_back(tex);
+    return int(cache->textures.size());
+}
+
+int TextureWidth(const TextureCache* cache, int id)
+{
+    return cache->textures[id - 1].header.width;
+}
+
+static void Unlink(CacheShard& c, int slot)
+{
+    CacheSlot& s = c.slots[slot];
+    (s.prev >= 0 ? c.slots[s.prev].next : c.head) = s.next;
+    (s.next >= 0 ? c.slots[s.next].prev : c.tail) = s.prev;
+}
+
+static void PushFront(CacheShard& c, int slot)
+{
+    CacheSlot& s = c.slots[slot];
+    s.prev = -1;
+    s.next = c.head;
+    (c.head >= 0 ? c.slots[c.head].prev : c.tail) = slot;
+    c.head = slot;
+}
+
+static uint64_t TileKey(int id, int level, int tx, int ty)
+{
+    return (uint64_t(id) << 48) | (uint64_t(level) << 40) | (uint64_t(ty) << 20) | uint64_t(tx);
+}
+
+static CacheShard& TileShard(TextureCache& cache, uint64_t key)
+{
+    // Fibonacci hashing, the top bits pick the shard
+    return cache.shards[(key * 0x9E3779B97F4A7C15ull) >> 60];
+}
+
+// tile of a mip level, read from disk on a miss; the shard's lock must be held
+static const uint8_t* FetchTile(CacheShard& c, TextureCache& cache, uint64_t key, int id, int level, int tx, int ty)
+{
+    const TextureFile& tex = cache.textures[id - 1];
+
+    int slot;
+    std::unordered_map<uint64_t, int>::iterator it = c.tileSlots.find(key);
+    if (it != c.tileSlots.end())
+    {
+        c.hits++;
+        slot = it->second;
+        if (slot != c.head)
+        {
+            Unlink(c, slot);
+            PushFront(c, slot);
+        }
+    }
+    else
+    {
+        c.misses++;
+        if (!c.freeSlots.empty())
+        {
+            slot = c.freeSlots.back();
+            c.freeSlots.pop_back();
+        }
+        else
+        {
+            slot = c.tail;
+            Unlink(c, slot);
+            c.tileSlots.erase(c.slots[slot].key);
+            c.evictions++;
+        }
+        uint8_t* dst = c.tileMemory + slot * kTileBytes;
+        uint64_t offset = tex.levelOffset[level] + (uint64_t(ty) * tex.levelTilesX[level] + tx) * kTileBytes;
+        {
+            std::lock_guard<std::mutex> fileLock(cache.fileMutex);
+            if (fseek64(tex.file, offset, SEEK_SET) != 0 || fread(dst, 1, kTileBytes, tex.file) != kTileBytes)
+                memset(dst, 0, kTileBytes); // truncated file, shows up black
+        }
+        c.bytesRead += kTileBytes;
+        c.slots[slot].key = key;
+        c.tileSlots[key] = slot;
+        PushFront(c, slot);
+    }
+    return c.tileMemory + slot * kTileBytes;
+}
+
+static float SrgbToLinear(uint8_t v)
+{
+    static float s_Table[256];
+    static bool s_Init = [] {
+        for (int i = 0; i < 256; i++)
+        {
+            float c = i / 255.0f;
+            s_Table[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return true;
+    }();
+    (void)s_Init;
+    return s_Table[v];
+}
+
+f3 SampleTexture(TextureCache* cache, int id, float u, float v, float footprint)
+{
+    const TextureFile& tex = cache->textures[id - 1];
+    if (!(u == u) || !(v == v))
+        return f3(0, 0, 0);
+
+    float texels = footprint * std::max(tex.header.width, tex.header.height);
+    int level = texels > 1 ? int(log2f(texels) + 0.5f) : 0;
+    level = std::min(level, int(tex.header.levels) - 1);
+    const int w = tex.levelWidth[level], h = tex.levelHeight[level];
+
+    float x = (u - floorf(u)) * w - 0.5f;
+    float y = std::min(1.0f, std::max(0.0f, v)) * h - 0.5f;
+    float fx = x - floorf(x), fy = y - floorf(y);
+    int x0 = int(floorf(x)), y0 = int(floorf(y));
+    int xs[2] = { (x0 % w + w) % w, ((x0 + 1) % w + w) % w };
+    int ys[2] = { std::max(0, y0), std::min(h - 1, y0 + 1) };
+
+    // the four texels mostly share a tile, which is then looked up once; its
+    // shard stays locked only while the raw texels are copied out
+    uint8_t rgba[4][4];
+    {
+        std::unique_lock<std::mutex> lock;
+        const uint8_t* tile = NULL;
+        int tileX = -1, tileY = -1;
+        for (int i = 0; i < 4; i++)
+        {
+            const int x = xs[i & 1], y = ys[i >> 1];
+            if (x / kTextureTileSize != tileX || y / kTextureTileSize != tileY)
+            {
+                tileX = x / kTextureTileSize;
+                tileY = y / kTextureTileSize;
+                const uint64_t key = TileKey(id, level, tileX, tileY);
+                CacheShard& shard = TileShard(*cache, key);
+                if (lock.owns_lock())
+                    lock.unlock();
+                lock = std::unique_lock<std::mutex>(shard.mutex);
+                tile = FetchTile(shard, *cache, key, id, level, tileX, tileY);
+            }
+            const uint8_t* t = tile + ((y % kTextureTileSize) * kTextureTileSize + x % kTextureTileSize) * 4;
+            memcpy(rgba[i], t, 4);
+        }
+    }
+    f3 texel[4];
+    for (int i = 0; i < 4; i++)
+        texel[i] = f3(SrgbToLinear(rgba[i][0]), SrgbToLinear(rgba[i][1]), SrgbToLinear(rgba[i][2]));
+    return (texel[0] * (1 - fx) + texel[1] * fx) * (1 - fy) + (texel[2] * (1 - fx) + texel[3] * fx) * fy;
+}
+
+void PrintTextureCacheStats(const TextureCache* cache)
+{
+    uint64_t hits = 0, misses = 0, evictions = 0, bytesRead = 0;
+    size_t slots = 0;
+    for (int s = 0; s < kTextureCacheShards; s++)
+    {
+        const CacheShard& shard = cache->shards[s];
+        hits += shard.hits;
+        misses += shard.misses;
+        evictions += shard.evictions;
+        bytesRead += shard.bytesRead;
+        slots += shard.slots.size();
+    }
+    uint64_t lookups = hits + misses;
+    printf("texture cache: %.2f%% tile hit rate over %llu lookups, %llu evictions, %.1fMB read, %.1fMB budget\n",
+        lookups ? 100.0 * hits / lookups : 0.0, (unsigned long long)lookups, (unsigned long long)evictions,
+        bytesRead / (1024.0 * 1024.0), slots * kTileBytes / (1024.0 * 1024.0));
+}
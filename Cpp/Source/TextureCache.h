@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Maths.h"
+#include <stddef.h>
+
+// Tiled, mip-mapped textures read lazily from disk through a cache with a fixed
+// memory budget. Tiles are evicted least recently used first, so texture sets
+// larger than RAM only cost the tiles the current frames actually touch.
+
+// texels along each side of a tile
+const int kTextureTileSize = 64;
+
+// File format (.ttex, little endian): this header, then the tiles of every mip
+// level from the finest down, each level's tiles in row-major order. A tile is
+// kTextureTileSize x kTextureTileSize sRGB RGBA8 texels, row 0 at v = 0; tiles
+// on the right and bottom edges are padded to full size.
+struct TiledTextureHeader
+{
+    char magic[4]; // "TTEX"
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t tileSize;
+    uint32_t levels;
+};
+
+// Builds the mip chain of an sRGB RGBA8 image with a box filter and writes it in
+// the tiled format. Returns false if the file can't be written.
+bool WriteTiledTexture(const char* path, const uint8_t* rgba, int width, int height);
+
+struct TextureCache;
+
+TextureCache* CreateTextureCache(size_t budgetBytes);
+void DestroyTextureCache(TextureCache* cache);
+
+// Opens a .ttex file; only the header is read. Returns a 1-based texture id, or 0
+// after printing why the file can't be used.
+int OpenTexture(TextureCache* cache, const char* path);
+int TextureWidth(const TextureCache* cache, int id);
+
+// Bilinear lookup of linear RGB at (u, v), wrapping in u and clamping in v. The
+// mip level is the one whose texels are about footprint wide in uv units.
+f3 SampleTexture(TextureCache* cache, int id, float u, float v, float footprint);
+
+// tile hits, misses, evictions and bytes read since creation
+void PrintTextureCacheStats(const TextureCache* cache);
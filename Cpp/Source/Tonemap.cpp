@@ -0,0 +1,166 @@
+#include "Tonemap.h"
+#include "Parallel.h"
+#include <math.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DO_SSE2_TONEMAP 1
+#include <emmintrin.h>
+#else
+#define DO_SSE2_TONEMAP 0
+#endif
+
+// steps of the tonemapped [0, 1] range the transfer table resolves; fine enough
+// that the steepest part of the sRGB curve moves less than one 8 bit level a step
+const int kTransferSteps = 4095;
+const int kTonemapRowChunk = 8;
+
+// 8 bit output level times 256 for every table step, so adding a dither
+// threshold in [0, 256) and shifting quantizes
+struct TransferTable
+{
+    uint16_t level[kTransferSteps + 1];
+};
+
+static void BuildTransferTable(TransferTable& table, bool srgb)
+{
+    for (int i = 0; i <= kTransferSteps; i++)
+    {
+        float v = float(i) / kTransferSteps;
+        if (srgb)
+            v = v <= 0.0031308f ? v * 12.92f : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+        table.level[i] = uint16_t(v * 255.0f * 256.0f);
+    }
+}
+
+// 8x8 Bayer matrix, times 4 plus 2 gives thresholds spread over [0, 256)
+static const uint8_t s_Bayer[8][8] =
+{
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+static inline float ToneCurve(float v, TonemapOperator op)
+{
+    v = v > 0 ? v : 0;
+    if (op == kTonemapReinhard)
+        v = v / (1.0f + v);
+    else if (op == kTonemapAces)
+        v = (v * (2.51f * v + 0.03f)) / (v * (2.43f * v + 0.59f) + 0.14f);
+    return v < 1 ? v : 1;
+}
+
+#if DO_SSE2_TONEMAP
+static inline __m128 ToneCurve4(__m128 v, TonemapOperator op)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    v = _mm_max_ps(v, _mm_setzero_ps());
+    if (op == kTonemapReinhard)
+        v = _mm_div_ps(v, _mm_add_ps(one, v));
+    else if (op == kTonemapAces)
+    {
+        __m128 num = _mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), v), _mm_set1_ps(0.03f)));
+        __m128 den = _mm_add_ps(_mm_mul_ps(v, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), v), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+        v = _mm_div_ps(num, den);
+    }
+    return _mm_min_ps(v, one);
+}
+#endif
+
+// tonemapped values in [0, range] for count consecutive floats of a row, channel
+// by channel, rounded to the table steps
+static void ToneRow(const float* src, int count, TonemapOperator op, int range, int32_t* steps)
+{
+    int i = 0;
+#if DO_SSE2_TONEMAP
+    const __m128 scale = _mm_set1_ps(float(range));
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i*)(steps + i), _mm_cvtps_epi32(_mm_mul_ps(ToneCurve4(_mm_loadu_ps(src + i), op), scale)));
+#endif
+    for (; i < count; i++)
+        steps[i] = int32_t(ToneCurve(src[i], op) * range + 0.5f);
+}
+
+// one row, 8 bit RGB out; thresholds repeat every 8 pixels
+static void QuantizeRow(const float* src, int width, int channels, TonemapOperator op, const uint16_t* level, const int* thresholds, int32_t* steps, uint8_t* out)
+{
+    int x = 0;
+#if DO_SSE2_TONEMAP
+    if (channels == 4)
+    {
+        // a pixel is a vector, no need to go through steps; steps fit in the low
+        // 16 bits of each lane
+        const __m128 scale = _mm_set1_ps(float(kTransferSteps));
+        for (; x < width; x++, src += 4, out += 3)
+        {
+            __m128i s = _mm_cvtps_epi32(_mm_mul_ps(ToneCurve4(_mm_loadu_ps(src), op), scale));
+            const int threshold = thresholds[x & 7];
+            out[0] = uint8_t((level[_mm_cvtsi128_si32(s)] + threshold) >> 8);
+            out[1] = uint8_t((level[_mm_extract_epi16(s, 2)] + threshold) >> 8);
+            out[2] = uint8_t((level[_mm_extract_epi16(s, 4)] + threshold) >> 8);
+        }
+        return;
+    }
+#endif
+    ToneRow(src, width * channels, op, kTransferSteps, steps);
+    for (; x < width; x++, steps += channels, out += 3)
+    {
+        const int threshold = thresholds[x & 7];
+        out[0] = uint8_t((level[steps[0]] + threshold) >> 8);
+        out[1] = uint8_t((level[steps[1]] + threshold) >> 8);
+        out[2] = uint8_t((level[steps[2]] + threshold) >> 8);
+    }
+}
+
+void TonemapImage(const float* src, int width, int height, int channels, const TonemapOptions& options, uint8_t* dst)
+{
+    // a few thousand powf calls, nothing next to the image itself
+    TransferTable table;
+    BuildTransferTable(table, options.srgb);
+    ParallelFor(height, kTonemapRowChunk, [&](int chunk, int begin, int end)
+    {
+        std::vector<int32_t> steps(width * channels);
+        for (int y = begin; y < end; y++)
+        {
+            int thresholds[8];
+            for (int x = 0; x < 8; x++)
+                thresholds[x] = options.dither ? s_Bayer[y & 7][x] * 4 + 2 : 128;
+            QuantizeRow(src + size_t(y) * width * channels, width, channels, options.op, table.level, thresholds,
+                steps.data(), dst + size_t(height - 1 - y) * width * 3);
+        }
+    });
+}
+
+void TonemapImage16(const float* src, int width, int height, int channels, const TonemapOptions& options, uint16_t* dst)
+{
+    // a table step per output level
+    std::vector<uint16_t> table(65536);
+    for (int i = 0; i < 65536; i++)
+    {
+        float v = float(i) / 65535.0f;
+        if (options.srgb)
+            v = v <= 0.0031308f ? v * 12.92f : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+        table[i] = uint16_t(v * 65535.0f + 0.5f);
+    }
+    ParallelFor(height, kTonemapRowChunk, [&](int chunk, int begin, int end)
+    {
+        std::vector<int32_t> steps(width * channels);
+        for (int y = begin; y < end; y++)
+        {
+            ToneRow(src + size_t(y) * width * channels, width * channels, options.op, 65535, steps.data());
+            uint16_t* out = dst + size_t(height - 1 - y) * width * 3;
+            for (int x = 0; x < width; x++)
+            {
+                out[x * 3 + 0] = table[steps[x * channels + 0]];
+                out[x * 3 + 1] = table[steps[x * channels + 1]];
+                out[x * 3 + 2] = table[steps[x * channels + 2]];
+            }
+        }
+    });
+}
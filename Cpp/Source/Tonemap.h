@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+enum TonemapOperator
+{
+    kTonemapClamp,    // linear values clipped to [0, 1]
+    kTonemapReinhard, // c / (1 + c) per channel
+    kTonemapAces,     // Narkowicz's fit of the ACES filmic curve, per channel
+};
+
+struct TonemapOptions
+{
+    TonemapOperator op;
+    bool srgb;   // sRGB transfer curve on the output, otherwise linear
+    bool dither; // ordered dither the 8 bit quantization instead of rounding
+
+    TonemapOptions() : op(kTonemapClamp), srgb(false), dither(false) {}
+};
+
+// Turns a linear float image, bottom row first with channels floats per pixel,
+// into 8 bit RGB top row first, which is what the image encoders take: dst is
+// width * height * 3 bytes. Rows are spread over the thread pool, the curve runs
+// four channels at a time with SSE2 and the transfer curve is a table lookup.
+void TonemapImage(const float* src, int width, int height, int channels, const TonemapOptions& options, uint8_t* dst);
+
+// The same with 16 bits per channel, in native byte order; no dithering.
+void TonemapImage16(const float* src, int width, int height, int channels, const TonemapOptions& options, uint16_t* dst);
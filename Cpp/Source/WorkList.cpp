@@ -0,0 +1,51 @@
+#include "WorkList.h"
+#include <algorithm>
+
+// bounds a single pixel's share of the wavefront however hot the importance map is
+const int kMaxRaysPerPixel = 1024;
+
+void BuildWorkList(WorkList& list, int width, int height, const WorkRegion& region, int samplesPerPixel)
+{
+    int x0 = 0, y0 = 0, x1 = width, y1 = height;
+    if (region.cropWidth > 0 && region.cropHeight > 0)
+    {
+        x0 = std::max(0, std::min(width, region.cropX));
+        y0 = std::max(0, std::min(height, region.cropY));
+        x1 = std::max(x0, std::min(width, region.cropX + region.cropWidth));
+        y1 = std::max(y0, std::min(height, region.cropY + region.cropHeight));
+    }
+
+    const int maxPixels = (x1 - x0) * (y1 - y0);
+    list.pixels = new int[maxPixels];
+    list.pixelFirstRay = new int[maxPixels + 1];
+    list.numPixels = 0;
+    list.numRays = 0;
+    for (int y = y0; y < y1; y++)
+    {
+        for (int x = x0; x < x1; x++)
+        {
+            const int p = y * width + x;
+            int rays = samplesPerPixel;
+            if (region.importance != NULL)
+            {
+                float imp = region.importance[p];
+                if (!(imp > 0))
+                    continue;
+                rays = std::min(kMaxRaysPerPixel, std::max(1, int(imp * samplesPerPixel + 0.5f)));
+            }
+            list.pixels[list.numPixels] = p;
+            list.pixelFirstRay[list.numPixels] = list.numRays;
+            list.numPixels++;
+            list.numRays += rays;
+        }
+    }
+    list.pixelFirstRay[list.numPixels] = list.numRays;
+}
+
+void FreeWorkList(WorkList& list)
+{
+    delete[] list.pixels;
+    delete[] list.pixelFirstRay;
+    list.pixels = list.pixelFirstRay = NULL;
+    list.numPixels = list.numRays = 0;
+}
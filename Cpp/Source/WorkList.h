@@ -0,0 +1,30 @@
+#pragma once
+
+// Pixels a frame traces and the rays each of them gets. The rays of one pixel
+// are consecutive in the wavefront, so the list only stores where each pixel's
+// run starts; pixels outside the crop window or with zero importance are left
+// out and cost nothing.
+struct WorkList
+{
+    int numPixels;
+    int numRays;
+    int* pixels;        // backbuffer pixel index, y * width + x
+    int* pixelFirstRay; // numPixels + 1 entries, the last one is numRays
+};
+
+struct WorkRegion
+{
+    // crop window in backbuffer pixels, rows counted from the bottom; a zero
+    // width or height means the whole frame
+    int cropX, cropY, cropWidth, cropHeight;
+    // optional per pixel sample count multiplier, width * height values
+    const float* importance;
+};
+
+// Every pixel of the crop window gets samplesPerPixel rays scaled by its
+// importance, rounded to the nearest count. A pixel with non zero importance
+// always gets at least one ray.
+void BuildWorkList(WorkList& list, int width, int height, const WorkRegion& region, int samplesPerPixel);
+void FreeWorkList(WorkList& list);
+
+inline int WorkListPixelRays(const WorkList& list, int i) { return list.pixelFirstRay[i + 1] - list.pixelFirstRay[i]; }
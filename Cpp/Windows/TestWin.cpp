@@ -2,48 +2,357 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <math.h>
 #include <algorithm>
+#include <string.h>
+#include <string>
 
 #define STBI_MSC_SECURE_CRT
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
 #include "../Source/Config.h"
+#include "../Source/FrameStream.h"
 #include "../Source/Test.h"
+#include "../Source/Memory.h"
+#include "../Source/RenderServer.h"
+#include "../Source/SharedFramebuffer.h"
+#include "../Source/TextureCache.h"
+#include "../Source/Timer.h"
+#include "../Source/Tonemap.h"
 
 static size_t RenderFrame();
 
 static float* g_Backbuffer;
+static TonemapOptions g_Tonemap;
+// with -stream, frames go here instead of into png files
+static FrameStream* g_Stream;
+// with -shm, every frame is also published here for live viewers
+static SharedFramebuffer* g_Shared;
+
+static bool write_backbuffer(const char* output_file, const float* pixels, int width, int height) {
+    uint8_t *data = new uint8_t[width * height * 3];
+    TonemapImage(pixels, width, height, kBackbufferChannels, g_Tonemap, data);
+    int ok = stbi_write_png(output_file, width, height, 3, (void*)data, width * 3);
+    delete[] data;
+    return ok != 0;
+}
 
 void write_image(const char* output_file) {
-    char *data = new char[kBackbufferWidth * kBackbufferHeight * 3];
-    int idx = 0;
-    for (int y = kBackbufferHeight - 1; y >= 0; y--) {
-        for (int x = 0; x < kBackbufferWidth; x++) {
-            const float * backbuffer = g_Backbuffer + (y*kBackbufferWidth + x) * 4;
-            data[idx++] = std::min(255, int(255.99*backbuffer[0]));
-            data[idx++] = std::min(255, int(255.99*backbuffer[1]));
-            data[idx++] = std::min(255, int(255.99*backbuffer[2]));
+    write_backbuffer(output_file, g_Backbuffer, kBackbufferWidth, kBackbufferHeight);
+}
+
+// the default view turned by an angle around its look-at point
+static CameraView OrbitView(float radians) {
+    CameraView def = DefaultCameraView();
+    float dx = def.lookFrom[0] - def.lookAt[0];
+    float dz = def.lookFrom[2] - def.lookAt[2];
+    CameraView view = def;
+    view.lookFrom[0] = def.lookAt[0] + dx * cosf(radians) - dz * sinf(radians);
+    view.lookFrom[2] = def.lookAt[2] + dx * sinf(radians) + dz * cosf(radians);
+    return view;
+}
+
+// orbits the default view around its look-at point, one degree per frame
+static bool OrbitCamera(void* user, int frame, CameraView& view) {
+    if (frame >= kNumFrames)
+        return false;
+    view = OrbitView(frame * 3.1415926f / 180.0f);
+    return true;
+}
+
+// numViews quarter size views evenly spaced around the orbit, rendered as one
+// batch into turntable_00.png, turntable_01.png, ...
+static void RenderTurntable(int numViews, int& rayCounter, const RenderOptions& options) {
+    const int w = kBackbufferWidth / 4, h = kBackbufferHeight / 4;
+    RenderView* views = new RenderView[numViews];
+    for (int v = 0; v < numViews; v++) {
+        views[v].camera = OrbitView(v * 2.0f * 3.1415926f / numViews);
+        views[v].width = w;
+        views[v].height = h;
+        views[v].backbuffer = new float[w * h * kBackbufferChannels]();
+    }
+    RenderViews(views, numViews, rayCounter, options);
+    for (int v = 0; v < numViews; v++) {
+        if (g_Stream != NULL)
+            PushStreamFrame(g_Stream, views[v].backbuffer, kBackbufferChannels);
+        else {
+            char path[64];
+            snprintf(path, sizeof(path), "turntable_%02d.png", v);
+            write_backbuffer(path, views[v].backbuffer, w, h);
         }
+        delete[] views[v].backbuffer;
     }
-    stbi_write_png(output_file, kBackbufferWidth, kBackbufferHeight, 3, (void*)data, kBackbufferWidth * 3);
-    delete[] data;
+    delete[] views;
+}
+
+static void PrintInteractiveFrame(void* user, int frame, float frameMs, float resolutionScale) {
+    if (frame % 10 == 0)
+        printf("frame %d: %.1fms at %.0f%% resolution\n", frame, frameMs, resolutionScale * 100.0f);
+    if (g_Stream != NULL)
+        PushStreamFrame(g_Stream, g_Backbuffer, kBackbufferChannels);
+    if (g_Shared != NULL)
+        PublishSharedFrame(g_Shared, g_Backbuffer, frame, DO_SAMPLES_PER_PIXEL);
+}
+
+static void RenderFrameDone(void* user, int frame, const float* backbuffer) {
+    if (g_Stream != NULL)
+        PushStreamFrame(g_Stream, backbuffer, kBackbufferChannels);
+    if (g_Shared != NULL) {
+        // progressive frames add up, animated ones start over
+        const int samples = DO_PROGRESSIVE && !DO_ANIMATION ? (frame + 1) * DO_SAMPLES_PER_PIXEL : DO_SAMPLES_PER_PIXEL;
+        PublishSharedFrame(g_Shared, backbuffer, frame, samples);
+    }
+}
+
+// Binary 8 bit PGM of the backbuffer size to per pixel importance. Mid grey
+// (128) keeps the default sample count, black skips the pixel.
+static float* LoadImportanceMask(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("can't open mask %s\n", path);
+        return NULL;
+    }
+    int width = 0, height = 0, maxVal = 0;
+    if (fscanf(f, "P5 %d %d %d", &width, &height, &maxVal) != 3 || fgetc(f) == EOF ||
+        width != kBackbufferWidth || height != kBackbufferHeight || maxVal != 255) {
+        printf("mask %s must be a binary %dx%d PGM with 8 bit values\n", path, kBackbufferWidth, kBackbufferHeight);
+        fclose(f);
+        return NULL;
+    }
+    unsigned char* grey = new unsigned char[width * height];
+    size_t read = fread(grey, 1, width * height, f);
+    fclose(f);
+    float* importance = NULL;
+    if (read == size_t(width * height)) {
+        // PGM rows go top down, backbuffer rows bottom up
+        importance = new float[width * height];
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                importance[(height - 1 - y) * width + x] = grey[y * width + x] / 128.0f;
+    }
+    else
+        printf("mask %s is truncated\n", path);
+    delete[] grey;
+    return importance;
+}
+
+// Binary 8 bit PPM to the tiled texture format, rows top down so the first one is
+// at v = 0. arg is "in.ppm,out.ttex".
+static bool MakeTiledTexture(const char* arg) {
+    const char* comma = strchr(arg, ',');
+    if (comma == NULL) {
+        printf("-maketex expects in.ppm,out.ttex\n");
+        return false;
+    }
+    std::string inPath(arg, comma);
+    FILE* f = fopen(inPath.c_str(), "rb");
+    if (f == NULL) {
+        printf("can't open %s\n", inPath.c_str());
+        return false;
+    }
+    int width = 0, height = 0, maxVal = 0;
+    if (fscanf(f, "P6 %d %d %d", &width, &height, &maxVal) != 3 || fgetc(f) == EOF || width <= 0 || height <= 0 || maxVal != 255) {
+        printf("%s must be a binary PPM with 8 bit values\n", inPath.c_str());
+        fclose(f);
+        return false;
+    }
+    unsigned char* rgb = new unsigned char[width * height * 3];
+    size_t read = fread(rgb, 1, width * height * 3, f);
+    fclose(f);
+    bool ok = false;
+    if (read == size_t(width * height * 3)) {
+        unsigned char* rgba = new unsigned char[width * height * 4];
+        for (int i = 0; i < width * height; i++) {
+            rgba[i * 4 + 0] = rgb[i * 3 + 0];
+            rgba[i * 4 + 1] = rgb[i * 3 + 1];
+            rgba[i * 4 + 2] = rgb[i * 3 + 2];
+            rgba[i * 4 + 3] = 255;
+        }
+        ok = WriteTiledTexture(comma + 1, rgba, width, height);
+        if (!ok)
+            printf("can't write %s\n", comma + 1);
+        delete[] rgba;
+    }
+    else
+        printf("%s is truncated\n", inPath.c_str());
+    delete[] rgb;
+    return ok;
+}
+
+static const int kMaxTextureArgs = 16;
+static const char* s_TexturePaths[kMaxTextureArgs];
+
+struct StreamArgs {
+    const char* path;
+    FrameStreamFormat format;
+    int fps;
+};
+
+static bool ParseArgs(int argc, char** argv, RenderOptions& options, float& interactiveMs, const char*& serveSocket, int& turntableViews, StreamArgs& stream, const char*& shmName) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "-backend=cpu") == 0)
+            options.backend = kBackendCpu;
+        else if (strcmp(arg, "-backend=emu") == 0)
+            options.backend = kBackendEmulatedDevice;
+        else if (strcmp(arg, "-backend=cuda") == 0)
+            options.backend = kBackendCuda;
+        else if (strncmp(arg, "-batch=", 7) == 0)
+            options.batchSize = atoi(arg + 7);
+        else if (strncmp(arg, "-frames=", 8) == 0)
+            options.maxFrames = atoi(arg + 8);
+        else if (strncmp(arg, "-time=", 6) == 0)
+            options.timeBudget = float(atof(arg + 6));
+        else if (strncmp(arg, "-error=", 7) == 0)
+            options.targetRelError = float(atof(arg + 7));
+        else if (strncmp(arg, "-crop=", 6) == 0) {
+            // image coordinates, top left origin
+            WorkRegion& r = options.region;
+            int x, y;
+            if (sscanf(arg + 6, "%d,%d,%d,%d", &x, &y, &r.cropWidth, &r.cropHeight) != 4) {
+                printf("-crop expects x,y,width,height\n");
+                return false;
+            }
+            r.cropX = x;
+            r.cropY = kBackbufferHeight - y - r.cropHeight;
+        }
+        else if (strncmp(arg, "-env=", 5) == 0)
+            options.envMap = arg + 5;
+        else if (strncmp(arg, "-tex=", 5) == 0) {
+            // in order, the first -tex is texture slot 1
+            if (options.textureCount == kMaxTextureArgs) {
+                printf("at most %d textures\n", kMaxTextureArgs);
+                return false;
+            }
+            s_TexturePaths[options.textureCount++] = arg + 5;
+            options.textures = s_TexturePaths;
+        }
+        else if (strncmp(arg, "-texcache=", 10) == 0)
+            options.textureCacheMB = atoi(arg + 10);
+        else if (strncmp(arg, "-cache=", 7) == 0)
+            options.radianceCacheDepth = atoi(arg + 7);
+        else if (strncmp(arg, "-mask=", 6) == 0) {
+            options.region.importance = LoadImportanceMask(arg + 6);
+            if (options.region.importance == NULL)
+                return false;
+        }
+        else if (strcmp(arg, "-tonemap=clamp") == 0)
+            g_Tonemap.op = kTonemapClamp;
+        else if (strcmp(arg, "-tonemap=reinhard") == 0)
+            g_Tonemap.op = kTonemapReinhard;
+        else if (strcmp(arg, "-tonemap=aces") == 0)
+            g_Tonemap.op = kTonemapAces;
+        else if (strcmp(arg, "-srgb") == 0)
+            g_Tonemap.srgb = true;
+        else if (strcmp(arg, "-dither") == 0)
+            g_Tonemap.dither = true;
+        else if (strncmp(arg, "-stream=", 8) == 0)
+            stream.path = arg + 8;
+        else if (strcmp(arg, "-streamformat=y4m") == 0)
+            stream.format = kStreamY4m;
+        else if (strcmp(arg, "-streamformat=rgb48") == 0)
+            stream.format = kStreamRgb48;
+        else if (strncmp(arg, "-fps=", 5) == 0) {
+            stream.fps = atoi(arg + 5);
+            if (stream.fps < 1) {
+                printf("-fps expects a positive frame rate\n");
+                return false;
+            }
+        }
+        else if (strncmp(arg, "-shm=", 5) == 0)
+            shmName = arg + 5;
+        else if (strncmp(arg, "-serve=", 7) == 0)
+            serveSocket = arg + 7;
+        else if (strncmp(arg, "-turntable=", 11) == 0) {
+            turntableViews = atoi(arg + 11);
+            if (turntableViews < 1 || turntableViews > 65536) {
+                printf("-turntable expects 1 to 65536 views\n");
+                return false;
+            }
+        }
+        else if (strcmp(arg, "-interactive") == 0)
+            interactiveMs = 100.0f;
+        else if (strncmp(arg, "-interactive=", 13) == 0)
+            interactiveMs = float(atof(arg + 13));
+        else {
+            printf("unknown argument %s\n", arg);
+            printf("usage: %s [-backend=cpu|emu|cuda] [-batch=rays] [-frames=max] [-time=seconds] [-error=relative] [-crop=x,y,w,h] [-mask=file.pgm] [-env=file.pfm|hdr] [-tex=file.ttex]... [-texcache=MB] [-cache=depth] [-tonemap=clamp|reinhard|aces] [-srgb] [-dither] [-stream=file|- [-streamformat=y4m|rgb48] [-fps=rate]] [-shm=/name] [-interactive[=targetMs] | -serve=socket | -turntable=views]\n", argv[0]);
+            printf("       %s -maketex=in.ppm,out.ttex\n", argv[0]);
+            return false;
+        }
+    }
+    return true;
 }
 
 int main(int argc, char** argv) {
-    g_Backbuffer = new float[kBackbufferWidth * kBackbufferHeight * 4];
-    memset(g_Backbuffer, 0, kBackbufferWidth * kBackbufferHeight * 4 * sizeof(g_Backbuffer[0]));
+    if (argc == 2 && strncmp(argv[1], "-maketex=", 9) == 0)
+        return MakeTiledTexture(argv[1] + 9) ? 0 : 1;
+
+    RenderOptions options;
+    float interactiveMs = 0;
+    const char* serveSocket = NULL;
+    int turntableViews = 0;
+    StreamArgs stream = { NULL, kStreamY4m, int(1.0f / kAnimationFrameTime + 0.5f) };
+    const char* shmName = NULL;
+    if (!ParseArgs(argc, argv, options, interactiveMs, serveSocket, turntableViews, stream, shmName))
+        return 1;
+    if (serveSocket != NULL) {
+        if (stream.path != NULL || shmName != NULL) {
+            printf("-stream and -shm don't go with -serve\n");
+            return 1;
+        }
+        return RunRenderServer(serveSocket, kBackbufferWidth, kBackbufferHeight, options, write_backbuffer);
+    }
+    if (stream.path != NULL) {
+        const int divisor = turntableViews > 0 ? 4 : 1;
+        g_Stream = OpenFrameStream(stream.path, stream.format, kBackbufferWidth / divisor, kBackbufferHeight / divisor, stream.fps, g_Tonemap);
+        if (g_Stream == NULL) {
+            printf("can't open %s for streaming\n", stream.path);
+            return 1;
+        }
+    }
+    if (shmName != NULL) {
+        if (turntableViews > 0) {
+            printf("-shm doesn't go with -turntable\n");
+            return 1;
+        }
+        g_Shared = CreateSharedFramebuffer(shmName, kBackbufferWidth, kBackbufferHeight, kBackbufferChannels);
+        if (g_Shared == NULL)
+            return 1;
+    }
+    options.frameDone = RenderFrameDone;
+
+    // zero filled, first touched a row at a time
+    g_Backbuffer = AllocLargeArray<float>(kBackbufferWidth * kBackbufferHeight * kBackbufferChannels, kBackbufferWidth * kBackbufferChannels);
 
     // Main rendering loop
-    const clock_t start_time = clock();
+    // wall clock; clock() would sum the CPU time of all pool threads
+    const double start_time = NowSeconds();
     int rayCounter = 0;
 
-    Render(kBackbufferWidth, kBackbufferHeight, g_Backbuffer, rayCounter);
+    if (turntableViews > 0) {
+        RenderTurntable(turntableViews, rayCounter, options);
+        const float duration = float(NowSeconds() - start_time);
+        printf("%d views, %.1fMrays/s, duration %.2fs\n", turntableViews, rayCounter / duration * 1.0e-6f, duration);
+        return g_Stream == NULL || CloseFrameStream(g_Stream) ? 0 : 1;
+    }
+    if (interactiveMs > 0) {
+        InteractiveSession session = { OrbitCamera, PrintInteractiveFrame, NULL, interactiveMs };
+        RenderInteractive(kBackbufferWidth, kBackbufferHeight, g_Backbuffer, rayCounter, session, options);
+    }
+    else {
+        Render(kBackbufferWidth, kBackbufferHeight, g_Backbuffer, rayCounter, options);
+    }
 
-    const float duration = (float) (clock() - start_time) / CLOCKS_PER_SEC;
+    const float duration = float(NowSeconds() - start_time);
     printf("%.1fMrays/s, duration %.2fs\n", rayCounter / duration * 1.0e-6f, duration);
+    printf("wavefront traffic %dB/ray, %.2fGB total\n", WavefrontBytesPerRay(), double(rayCounter) * WavefrontBytesPerRay() * 1.0e-9);
 
+    if (g_Shared != NULL)
+        DestroySharedFramebuffer(g_Shared);
+    if (g_Stream != NULL)
+        return CloseFrameStream(g_Stream) ? 0 : 1;
     write_image("image.png");
 
     return 0;